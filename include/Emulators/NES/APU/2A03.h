@@ -2,11 +2,14 @@
 
 //Includes
 #include <cstdint>
-#include <functional>
 #include <thread>
+#include <mutex>
 
 #include <iostream>
 
+#include "BlipBuffer.h"
+#include "../SaveState.h"
+
 namespace UnifiedEmulation
 {
     namespace NES{
@@ -19,39 +22,54 @@ namespace UnifiedEmulation
             void cpuWrite(uint16_t addr, uint8_t data);
             uint8_t cpuRead(uint16_t addr);
             void clock();
+            //Run a number of master clocks, jumping over the steps where no channel changes
+            void Run(uint32_t nClocks);
             void reset();
 
-            double GetOutputSample();
+            //Channels, frame counter and the unread part of the blip buffer to or from a save state
+            void Serialize(StateStream& s);
+
+            //Samples made since the last read, oldest first, returns how many were copied
+            size_t ReadSamples(float* pOut, size_t nMax);
+            void DiscardSamples() { nSampleRead = nSampleWrite; }
+            //Newest sample made, whether or not it has been read
+            float GetLatestSample() { return fSamples[(nSampleWrite - 1) & (nSampleBufferSize - 1)]; }
+
+            //Samples are taken at a fixed fraction of the master clock, the frontend resamples them for the device
+            static const uint32_t nClocksPerSample = 96;
+            static constexpr double dClockRate = 5369318.0;
+            static constexpr double dSampleRate = dClockRate / nClocksPerSample;
+
+            //Clocks before the clock that runs the next frame counter step
+            uint32_t ClocksUntilFrameStep();
 
         private:
             uint32_t frame_clock_counter = 0;
             uint32_t clock_counter = 0;
-            bool bUseRawMode = false;
 
         private:
             static uint8_t length_table[];
 
         public:
 
-            struct sequencer{
-                uint32_t sequence = 0x00000000;
-                uint32_t new_sequence = 0x00000000;
-                uint16_t timer = 0x0000;
-                uint16_t reload = 0x0000;
-                uint8_t output = 0x00;
-
-                // Pass in a lambda function to manipulate the sequence as required
-                // by the owner of this sequencer module
-                uint8_t clock(bool bEnable, std::function<void(uint32_t &s)> funcManip){
-                    if (bEnable){
-                        timer--;
-                        if (timer == 0xFFFF){
-                            timer = reload;
-                            funcManip(sequence);
-                            output = sequence & 0x00000001;
-                        }
-                    }
-                    return output;
+            //Sequence manipulators, applied when a channel timer expires
+            struct PulseRotate{
+                void operator()(uint32_t &s) const {
+                    // Shift right by 1 bit, wrapping around
+                    s = ((s & 0x0001) << 7) | ((s & 0x00FE) >> 1);
+                }
+            };
+
+            struct NoiseShift{
+                void operator()(uint32_t &s) const {
+                    s = (((s & 0x0001) ^ ((s & 0x0002) >> 1)) << 14) | ((s & 0x7FFF) >> 1);
+                }
+            };
+
+            struct TriangleStep{
+                void operator()(uint32_t &s) const {
+                    // Step through the 32 step ramp down and back up
+                    s = (s + 1) & 0x001F;
                 }
             };
 
@@ -122,36 +140,6 @@ namespace UnifiedEmulation
             };
 
 
-            struct oscpulse{
-                double frequency = 0;
-                double dutycycle = 0;
-                double amplitude = 1;
-                double pi = 3.14159;
-                double harmonics = 20;
-
-                double sample(double t){
-                    double a = 0;
-                    double b = 0;
-                    double p = dutycycle * 2.0 * pi;
-
-                    auto approxsin = [](float t){
-                        float j = t * 0.15915;
-                        j = j - (int)j;
-                        return 20.785 * j * (j - 0.5) * (j - 1.0f);
-                    };
-
-                    for (double n = 1; n < harmonics; n++){
-                        double c = n * frequency * 2.0 * pi * t;
-                        a += -approxsin(c) / n;
-                        b += -approxsin(c - p * n) / n;
-                        //a += -sin(c) / n;
-                        //b += -sin(c - p * n) / n;
-                    }
-
-                    return (2.0 * amplitude / pi) * (a - b);
-                }
-            };
-
             struct sweeper{
                 bool enabled = false;
                 bool down = false;
@@ -200,56 +188,120 @@ namespace UnifiedEmulation
             };
         
         private:
+            enum CHANNEL{
+                PULSE1,
+                PULSE2,
+                TRIANGLE,
+                NOISE,
+                CHANNEL_COUNT,
+            };
 
-            double dGlobalTime = 0.0;
-
-            // Square Wave Pulse Channel 1
-            bool pulse1_enable = false;
-            bool pulse1_halt = false;
-            double pulse1_sample = 0.0;
-            double pulse1_output = 0.0;
-            sequencer pulse1_seq;
-            oscpulse pulse1_osc;
-            envelope pulse1_env;
-            lengthcounter pulse1_lc;
-            sweeper pulse1_sweep;
-
-            // Square Wave Pulse Channel 2
-            bool pulse2_enable = false;
-            bool pulse2_halt = false;
-            double pulse2_sample = 0.0;
-            double pulse2_output = 0.0;
-            sequencer pulse2_seq;
-            oscpulse pulse2_osc;
-            envelope pulse2_env;
-            lengthcounter pulse2_lc;
-            sweeper pulse2_sweep;
-
-            // Triangle Channel
-            bool triangle_enable = false;
-            bool triangle_halt = false;
-            double triangle_sample = 0.0;
-            double triangle_output = 0.0;
+            //Channel state laid out field by field so the per step work runs over all channels together
+            struct{
+                bool enable[CHANNEL_COUNT] = {};
+                bool halt[CHANNEL_COUNT] = {};
+                uint16_t timer[CHANNEL_COUNT] = {};
+                uint16_t reload[CHANNEL_COUNT] = {};
+                uint32_t sequence[CHANNEL_COUNT] = {};
+                uint32_t new_sequence[CHANNEL_COUNT] = {};
+                uint8_t output[CHANNEL_COUNT] = {};
+                uint8_t level[CHANNEL_COUNT] = {};
+            } channel;
+
+            //Frame counter driven units
+            envelope env[CHANNEL_COUNT];
+            lengthcounter lc[CHANNEL_COUNT];
+            sweeper sweep[2];
             lincounter triangle_linc;
-            sequencer triangle_seq;
-            lengthcounter triangle_lc;
-            oscpulse triangle_osc;
 
-            // Noise Channel
-            bool noise_enable = false;
-            bool noise_halt = false;
-            envelope noise_env;
-            lengthcounter noise_lc;
-            sequencer noise_seq;
-            double noise_sample = 0;
-            double noise_output = 0;
+            //Timer decrements per apu step, the triangle runs at the cpu rate
+            static const uint8_t nTimerSteps[CHANNEL_COUNT];
+
+            //Channel levels are mixed as they change and band limited at the output rate
+            BlipBuffer blip;
+            uint32_t nSampleClock = 0;
+
+            //Samples wait here until the system is read, a few frames worth, the oldest are dropped once it fills
+            static const uint32_t nSampleBufferSize = 4096;
+            float fSamples[nSampleBufferSize] = {};
+            uint32_t nSampleWrite = 0;
+            uint32_t nSampleRead = 0;
+
+            //Move the sample clock on, finishing a sample at every nClocksPerSample
+            void AdvanceSampleClock(uint32_t nClocks){
+                nSampleClock += nClocks;
+                while (nSampleClock >= nClocksPerSample){
+                    nSampleClock -= nClocksPerSample;
+                    EmitSample();
+                }
+            }
+            void EmitSample();
+
+            //Non linear mixer output for the summed pulse levels and for 3 * triangle + 2 * noise + dmc, in 1/65536ths of full scale
+            static int32_t pulse_table[31];
+            static int32_t tnd_table[203];
+            static std::once_flag MixTablesBuilt;
+            static void BuildMixTables();
+
+            //Mixer output the blip buffer is currently at
+            int32_t nMixLevel = 0;
+
+            //A register write may change any level, so the next step is run in full
+            bool bLevelDirty = true;
+
+            void SetLevel(CHANNEL c, uint8_t nNew){
+                if (nNew != channel.level[c]){
+                    channel.level[c] = nNew;
+
+                    //The mix is not a sum of the channels, so step the buffer by the change in the whole mix
+                    int32_t nMix = pulse_table[channel.level[PULSE1] + channel.level[PULSE2]]
+                        + tnd_table[3 * channel.level[TRIANGLE] + 2 * channel.level[NOISE]];
+                    blip.AddDelta(nSampleClock, nMix - nMixLevel);
+                    nMixLevel = nMix;
+                }
+            }
+
+            //Count the channel timer down once, running the manipulator on expiry
+            template<typename Manip>
+            void ClockTimer(CHANNEL c, bool bEnable){
+                if (bEnable){
+                    channel.timer[c]--;
+                    if (channel.timer[c] == 0xFFFF){
+                        channel.timer[c] = channel.reload[c];
+                        Manip()(channel.sequence[c]);
+                        channel.output[c] = channel.sequence[c] & 0x00000001;
+                    }
+                }
+            }
+
+            bool TriangleRunning(){
+                return channel.enable[TRIANGLE] && lc[TRIANGLE].counter > 0 && triangle_linc.reload > 0;
+            }
+
+            //One apu step with everything that happens on it
+            void Step();
+            //Apu steps from the current one up to and including the next that changes anything
+            uint32_t StepsUntilEvent();
+            //Frequency sweepers follow the timer periods on every clock
+            void Track();
 
 
         public:
-            uint16_t pulse1_visual = 0;
-            uint16_t pulse2_visual = 0;
-            uint16_t noise_visual = 0;
-            uint16_t triangle_visual = 0;
+            //Pulse 1, pulse 2, triangle then noise
+            static const int nScopeChannels = CHANNEL_COUNT;
+            static const uint32_t nScopeSize = 1024;
+            static const uint32_t nScopeDecimation = 8;
+
+            //Level 0 - 15 of a channel nAgo scope entries before the newest
+            uint8_t GetScopeLevel(int nChannel, uint32_t nAgo){
+                return scope[nChannel][(nScopeWrite - 1 - nAgo) & (nScopeSize - 1)];
+            }
+
+        private:
+            //Recent channel levels for the debug scope, an entry every nScopeDecimation output samples
+            uint8_t scope[CHANNEL_COUNT][nScopeSize] = {};
+            uint32_t nScopeWrite = 0;
+            uint32_t nScopeCount = 0;
             
         };
         
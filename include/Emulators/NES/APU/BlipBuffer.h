@@ -0,0 +1,50 @@
+#pragma once
+
+//Includes
+#include <cstdint>
+#include <mutex>
+
+namespace UnifiedEmulation
+{
+    namespace NES{
+        //Band limited synthesis, channels hand in amplitude steps at the clock they happen and each step
+        //is spread over a few output samples with a windowed sinc, reading a sample sums the steps back up
+        class BlipBuffer{
+        public:
+            BlipBuffer();
+
+            //Rate the step clocks count at and the rate samples are read at
+            void SetRates(double dClockRate, double dSampleRate);
+            void Clear();
+
+            //Amplitude step nClock clocks after the last sample was read
+            void AddDelta(uint32_t nClock, int32_t nDelta);
+
+            //Finish the current sample, step clocks count from zero again afterwards
+            int32_t ReadSample();
+
+        public:
+            static const int nTaps = 16;
+            static const int nPhaseBits = 6;
+            static const int nPhases = 1 << nPhaseBits;
+            static const int nKernelBits = 15;
+
+        private:
+            //Room for the taps plus a sample period that runs long
+            static const int nBufferSize = 64;
+
+            //Every phase sums to exactly 1 << nKernelBits so steps settle on their exact level
+            static int32_t step_table[nPhases][nTaps];
+            //Built once by whichever buffer is constructed first, systems may be created on any thread
+            static std::once_flag TableBuilt;
+            static void BuildStepTable();
+
+            //Output samples per clock in 32.32 fixed point
+            uint64_t nSamplesPerClock = 0;
+
+            int64_t buffer[nBufferSize];
+            uint32_t nRead = 0;
+            int64_t nIntegrator = 0;
+        };
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+//Includes
+#include <cstdint>
+#include <cstddef>
+
+namespace UnifiedEmulation
+{
+    namespace NES{
+        //The console's analogue output stage, high passes at 90Hz and 440Hz then a low pass at 14kHz
+        //Runs over blocks of apu samples, four samples at a time through each one pole section
+        class OutputFilter{
+        public:
+            OutputFilter();
+
+            void SetRate(double dSampleRate);
+            void Clear();
+
+            //Filter a block of samples in place
+            void Process(float* pSamples, size_t nSamples);
+
+        private:
+            //One pole section, y[n] = a * y[n-1] + b0 * x[n] + b1 * x[n-1]
+            struct Stage{
+                float a = 0.0f;
+                float b0 = 1.0f;
+                float b1 = 0.0f;
+
+                //Four outputs from the last output and four inputs, fPower[i] = a^(i+1) and fColumn[j][i] = a^(i-j) for i >= j
+                alignas(16) float fPower[4];
+                alignas(16) float fColumn[4][4];
+
+                float x1 = 0.0f;
+                float y1 = 0.0f;
+
+                void Design(float fA, float fB0, float fB1);
+                void Run(float* pSamples, size_t nSamples, float* pScratch);
+            };
+
+            enum{
+                HIGHPASS_90,
+                HIGHPASS_440,
+                LOWPASS_14K,
+                STAGE_COUNT,
+            };
+
+            Stage stages[STAGE_COUNT];
+
+            //Input terms of a stage, blocks longer than this are filtered in pieces
+            static constexpr size_t nScratchSize = 512;
+            alignas(16) float scratch[nScratchSize];
+        };
+    }
+}
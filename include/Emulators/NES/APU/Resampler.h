@@ -0,0 +1,52 @@
+#pragma once
+
+//Includes
+#include <cstdint>
+#include <cstddef>
+
+namespace UnifiedEmulation
+{
+    namespace NES{
+        //Polyphase fir resampler, takes the apu's fixed rate output to whatever rate the audio device runs at
+        //Each output sample blends the two kernel phases either side of its position, the ratio can be trimmed at any time
+        class Resampler{
+        public:
+            Resampler();
+
+            //Design the filter for converting between two rates, clears any buffered input
+            void SetRates(double dInputRate, double dOutputRate);
+            //Trim the conversion, above 1 gives more output for the same input
+            void SetRatio(double dNewRatio);
+            double GetRatio() { return dRatio; }
+            void Clear();
+
+            //Feed input and write at most nMaxOut output samples, returns the number written
+            //Input that can not be turned into output yet is kept for the next call
+            size_t Process(const float* pIn, size_t nIn, float* pOut, size_t nMaxOut);
+
+        public:
+            static const int nTaps = 32;
+            static const int nPhaseBits = 8;
+            static const int nPhases = 1 << nPhaseBits;
+
+        private:
+            //Phases 0 to nPhases, the extra one lets the last phase blend towards the next sample
+            alignas(32) float kernel[nPhases + 1][nTaps];
+
+            //Buffered input, the oldest nTaps - 1 samples are history for the next output
+            static const int nInputSize = 2048;
+            float input[nInputSize];
+            size_t nInputCount = 0;
+
+            //Read position into the buffered input and the step per output sample, both 32.32 fixed point
+            uint64_t nPosition = 0;
+            uint64_t nStep = 0;
+
+            double dInputRate = 1.0;
+            double dOutputRate = 1.0;
+            double dRatio = 1.0;
+
+            size_t Run(float* pOut, size_t nMaxOut);
+        };
+    }
+}
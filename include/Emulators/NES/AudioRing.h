@@ -0,0 +1,136 @@
+#pragma once
+
+//Includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace UnifiedEmulation
+{
+    namespace NES{
+        //Single producer single consumer sample ring, one thread writes blocks and another drains them
+        //Indices only ever count up and live on their own cache lines so the two sides never share a line
+        template<typename T>
+        class AudioRing{
+        public:
+            //Capacity is rounded up to a power of two, call before either side starts
+            void Allocate(size_t nSamples){
+                size_t nCapacity = 1;
+                while (nCapacity < nSamples)
+                    nCapacity <<= 1;
+
+                buffer.assign(nCapacity, T(0));
+                nMask = nCapacity - 1;
+                nWrite.store(0);
+                nRead.store(0);
+                nUnderruns.store(0);
+                nOverruns.store(0);
+            }
+
+            size_t Capacity() const { return buffer.size(); }
+            //Sequentially consistent so a waiter that has just flagged itself can not miss a write
+            size_t Available() const { return nWrite.load() - nRead.load(); }
+            size_t Free() const { return Capacity() - Available(); }
+
+            //Producer side, samples that do not fit are dropped and counted as an overrun
+            size_t Write(const T* pSamples, size_t nSamples){
+                size_t w = nWrite.load(std::memory_order_relaxed);
+                size_t r = nRead.load(std::memory_order_acquire);
+                size_t nCount = std::min(nSamples, Capacity() - (w - r));
+
+                CopyIn(w, pSamples, nCount);
+                nWrite.store(w + nCount);
+
+                if (nCount < nSamples)
+                    nOverruns++;
+
+                Notify(bReaderWaiting);
+                return nCount;
+            }
+
+            //Consumer side, a short read is counted as an underrun
+            size_t Read(T* pSamples, size_t nSamples){
+                size_t r = nRead.load(std::memory_order_relaxed);
+                size_t w = nWrite.load(std::memory_order_acquire);
+                size_t nCount = std::min(nSamples, w - r);
+
+                CopyOut(r, pSamples, nCount);
+                nRead.store(r + nCount);
+
+                if (nCount < nSamples)
+                    nUnderruns++;
+
+                Notify(bWriterWaiting);
+                return nCount;
+            }
+
+            //Block the consumer until nSamples can be read or the timeout passes
+            bool WaitForData(size_t nSamples, std::chrono::microseconds timeout){
+                return Wait(bReaderWaiting, timeout, [&]() { return Available() >= nSamples; });
+            }
+
+            //Block the producer until nSamples can be written or the timeout passes
+            bool WaitForSpace(size_t nSamples, std::chrono::microseconds timeout){
+                return Wait(bWriterWaiting, timeout, [&]() { return Free() >= nSamples; });
+            }
+
+            uint64_t GetUnderruns() const { return nUnderruns.load(std::memory_order_relaxed); }
+            uint64_t GetOverruns() const { return nOverruns.load(std::memory_order_relaxed); }
+
+        private:
+            void CopyIn(size_t w, const T* pSamples, size_t nCount){
+                size_t nStart = w & nMask;
+                size_t nFirst = std::min(nCount, Capacity() - nStart);
+                memcpy(buffer.data() + nStart, pSamples, nFirst * sizeof(T));
+                memcpy(buffer.data(), pSamples + nFirst, (nCount - nFirst) * sizeof(T));
+            }
+
+            void CopyOut(size_t r, T* pSamples, size_t nCount){
+                size_t nStart = r & nMask;
+                size_t nFirst = std::min(nCount, Capacity() - nStart);
+                memcpy(pSamples, buffer.data() + nStart, nFirst * sizeof(T));
+                memcpy(pSamples + nFirst, buffer.data(), (nCount - nFirst) * sizeof(T));
+            }
+
+            //The lock is only taken when the other side has said it is sleeping
+            void Notify(std::atomic<bool>& bWaiting){
+                if (bWaiting.load()){
+                    std::lock_guard<std::mutex> lock(muxWait);
+                    cvWait.notify_all();
+                }
+            }
+
+            template<typename Ready>
+            bool Wait(std::atomic<bool>& bWaiting, std::chrono::microseconds timeout, Ready ready){
+                if (ready())
+                    return true;
+
+                std::unique_lock<std::mutex> lock(muxWait);
+                bWaiting.store(true);
+                bool bReady = cvWait.wait_for(lock, timeout, ready);
+                bWaiting.store(false);
+                return bReady;
+            }
+
+        private:
+            alignas(64) std::atomic<size_t> nWrite{0};
+            alignas(64) std::atomic<size_t> nRead{0};
+
+            alignas(64) std::atomic<uint64_t> nUnderruns{0};
+            std::atomic<uint64_t> nOverruns{0};
+
+            alignas(64) std::vector<T> buffer;
+            size_t nMask = 0;
+
+            std::atomic<bool> bReaderWaiting{false};
+            std::atomic<bool> bWriterWaiting{false};
+            std::mutex muxWait;
+            std::condition_variable cvWait;
+        };
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+//Includes
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace UnifiedEmulation
+{
+    namespace NES{
+        //Somewhere for finished audio to go when there is no device pulling it, the caller pushes blocks in
+        class AudioSink{
+        public:
+            virtual ~AudioSink() {}
+
+            virtual bool Open(unsigned int nSampleRate, unsigned int nChannels) = 0;
+            //Interleaved samples, nFrames of them per channel
+            virtual void Write(const float* pSamples, size_t nFrames) = 0;
+            virtual void Close() = 0;
+
+            uint64_t GetFramesWritten() { return nFramesWritten; }
+
+        protected:
+            uint64_t nFramesWritten = 0;
+        };
+
+        //Throws everything away, lets the core run as fast as it can
+        class NullSink : public AudioSink{
+        public:
+            bool Open(unsigned int nSampleRate, unsigned int nChannels) override { return true; }
+            void Write(const float* pSamples, size_t nFrames) override { nFramesWritten += nFrames; }
+            void Close() override {}
+        };
+
+        //Streams 16 bit pcm to a .wav file, samples are gathered into large writes and the sizes filled in on close
+        class WavSink : public AudioSink{
+        public:
+            WavSink(const std::string& sFileName) : sFile(sFileName) {}
+            ~WavSink() { Close(); }
+
+            bool Open(unsigned int nSampleRate, unsigned int nChannels) override {
+                pFile = fopen(sFile.c_str(), "wb");
+                if (pFile == nullptr)
+                    return false;
+
+                m_nChannels = nChannels;
+                m_nSampleRate = nSampleRate;
+                vBuffer.reserve(nBufferSize);
+                nFramesWritten = 0;
+
+                //Sizes are left at zero until the file is closed
+                WriteHeader(0);
+                return true;
+            }
+
+            void Write(const float* pSamples, size_t nFrames) override {
+                if (pFile == nullptr)
+                    return;
+
+                size_t nSamples = nFrames * m_nChannels;
+                for (size_t i = 0; i < nSamples; i++){
+                    float fSample = std::min(std::max(pSamples[i], -1.0f), 1.0f);
+                    vBuffer.push_back((int16_t)(fSample * 32767.0f));
+
+                    if (vBuffer.size() == nBufferSize)
+                        Flush();
+                }
+
+                nFramesWritten += nFrames;
+            }
+
+            void Close() override {
+                if (pFile == nullptr)
+                    return;
+
+                Flush();
+                fseek(pFile, 0, SEEK_SET);
+                WriteHeader((uint32_t)(nFramesWritten * m_nChannels * sizeof(int16_t)));
+                fclose(pFile);
+                pFile = nullptr;
+            }
+
+        private:
+            //Samples held back before each write to the file
+            static const size_t nBufferSize = 1 << 16;
+
+            std::string sFile;
+            FILE* pFile = nullptr;
+            std::vector<int16_t> vBuffer;
+            unsigned int m_nChannels = 1;
+            unsigned int m_nSampleRate = 48000;
+
+            void Flush(){
+                fwrite(vBuffer.data(), sizeof(int16_t), vBuffer.size(), pFile);
+                vBuffer.clear();
+            }
+
+            //Canonical 44 byte pcm header, fields written little endian
+            void WriteHeader(uint32_t nDataBytes){
+                auto Write32 = [&](uint32_t n) { uint8_t b[4] = { (uint8_t)n, (uint8_t)(n >> 8), (uint8_t)(n >> 16), (uint8_t)(n >> 24) }; fwrite(b, 1, 4, pFile); };
+                auto Write16 = [&](uint16_t n) { uint8_t b[2] = { (uint8_t)n, (uint8_t)(n >> 8) }; fwrite(b, 1, 2, pFile); };
+
+                fwrite("RIFF", 1, 4, pFile);
+                Write32(36 + nDataBytes);
+                fwrite("WAVE", 1, 4, pFile);
+
+                fwrite("fmt ", 1, 4, pFile);
+                Write32(16);
+                Write16(1);
+                Write16((uint16_t)m_nChannels);
+                Write32(m_nSampleRate);
+                Write32(m_nSampleRate * m_nChannels * sizeof(int16_t));
+                Write16((uint16_t)(m_nChannels * sizeof(int16_t)));
+                Write16(16);
+
+                fwrite("data", 1, 4, pFile);
+                Write32(nDataBytes);
+            }
+        };
+    }
+}
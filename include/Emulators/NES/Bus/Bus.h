@@ -39,26 +39,113 @@ namespace UnifiedEmulation {
 
         public: //Bus Read and Write
             uint8_t ASMRead(uint16_t addr, bool bReadOnly);
-            void cpuWrite(uint16_t addr, uint8_t data);
-            uint8_t cpuRead(uint16_t addr, bool bReadOnly = false);
 
-            double dAudioSample = 0.0;
-            void SetSampleFrequency(uint32_t sample_rate);
-        
-        private:
-            double dAudioTimePerSystemSample = 0.0;
-            double dAudioTimePerNESClock = 0.0;
-            double dAudioTime = 0.0;
-            double dAudioGlobalTime = 0.0;
+            //Mapped pages are accessed directly, everything else goes through the handlers
+            void cpuWrite(uint16_t addr, uint8_t data){
+                uint8_t* page = pWritePage[addr >> 8];
+                if(page) page[addr & 0xFF] = data;
+                else cpuWriteHandler(addr, data);
+            }
+            uint8_t cpuRead(uint16_t addr, bool bReadOnly = false){
+                const uint8_t* page = pReadPage[addr >> 8];
+                if(page) return page[addr & 0xFF];
+                return cpuReadHandler(addr, bReadOnly);
+            }
+
+            //Samples made since the last read, one on the last master clock of every APU2A03::nClocksPerSample
+            size_t ReadAudio(float* pOut, size_t nMax) { return apu.ReadSamples(pOut, nMax); }
+            void DiscardAudio() { apu.DiscardSamples(); }
+            static constexpr double GetSampleRate() { return APU2A03::dSampleRate; }
 
         public: //Interface
             void insertCartridge(const std::shared_ptr<Cartridge>& cartridge);
             void reset();
+            //Runs the system on by at least a master clock, returns true when a frame has finished
             bool clock();
+
+        public: //Save States
+            //Bytes a snapshot of the inserted cartridge takes, the same for every snapshot of it
+            size_t GetStateSize();
+            //Snapshot into a caller owned buffer without allocating, returns the bytes used or 0 if it does not fit
+            size_t SaveState(uint8_t* pBuffer, size_t nSize);
+            //Restore a snapshot of the same cartridge, nothing changes if it does not match
+            bool LoadState(const uint8_t* pBuffer, size_t nSize);
+
+        public: //Run Modes
+            enum RUNMODE{
+                RUN_DOT, //PPU, APU and CPU stepped every master clock
+                RUN_CATCHUP, //CPU runs whole instructions, PPU and APU caught up on access
+                RUN_LOCKSTEP, //Catch up checked against a dot stepped copy of the system
+            };
+
+            void SetRunMode(RUNMODE mode);
+            RUNMODE GetRunMode() { return nRunMode; }
+            bool LockstepDiverged() { return bLockstepDiverged; }
+
+        private: //Memory Map
+            //256 byte pages over the CPU address space, RAM, PRG and cartridge RAM point straight at memory
+            const uint8_t* pReadPage[256];
+            uint8_t* pWritePage[256];
+
+            //Rebuild the pages after the cartridge or its banks change
+            void MapPages();
+            uint32_t nPageGeneration = 0;
+
+            uint8_t cpuReadHandler(uint16_t addr, bool bReadOnly);
+            void cpuWriteHandler(uint16_t addr, uint8_t data);
+
+        private:
+            RUNMODE nRunMode = RUN_CATCHUP;
+
+            bool clockDot();
+            //Runs until a frame finishes or up to and including nLimit
+            bool clockCatchUp(uint64_t nLimit = UINT64_MAX);
+            bool clockLockstep();
+            void clockDMA();
+            //The mapper holds its IRQ line until the game acknowledges it, the CPU takes it between instructions once I is clear
+            void PollIRQ(uint64_t nTick);
+
+            //Bring the PPU and APU up to and including the given master clock
+            void CatchUpPPU(uint64_t tick);
+            void CatchUpAPU(uint64_t tick);
+
+        private: //Event Scheduler
+            enum EVENT{
+                EVENT_VBLANK, //PPU raises vertical blank and maybe NMI
+                EVENT_IRQ, //Mapper scanline counter reaches zero
+                EVENT_DMA, //OAM DMA releases the CPU
+                EVENT_FRAME, //APU frame counter step
+                EVENT_FRAMEEND, //PPU finishes the frame
+                EVENT_COUNT,
+            };
+
+            //Master clock of each pending event, never later than the event itself
+            uint64_t nEventTick[EVENT_COUNT];
+            bool bScheduleDirty = true;
+            bool bIRQDirty = false;
+
+            void Schedule(EVENT event);
+            void RunEvent(EVENT event);
+            EVENT NextEvent();
+
+            //Master clock of the CPU slot being executed and the next clock each device will run
+            uint64_t nCpuTick = 0;
+            uint64_t nPPUTick = 0;
+            uint64_t nAPUTick = 0;
+
+            //Reference system for lockstep comparison
+            Bus* pLockstep = nullptr;
+            bool bLockstepDiverged = false;
+            void StartLockstep();
+            void CompareLockstep();
+
+        private: //Save States
+            SaveStateHeader GetStateHeader();
+            void Serialize(StateStream& s);
         
         private:
             //Clock Cycles Passed
-            uint32_t nSystemClockCounter = 0;
+            uint64_t nSystemClockCounter = 0;
 
             // Internal cache of controller state
 	        uint8_t controller_state[2];
@@ -4,6 +4,8 @@
 #include <vector>
 #include <map>
 
+#include "../SaveState.h"
+
 namespace UnifiedEmulation {
     namespace NES {
         class Bus;
@@ -64,6 +66,9 @@ namespace UnifiedEmulation {
             void irq();
             void nmi();
 
+            //Registers and the instruction in flight to or from a save state
+            void Serialize(StateStream& s);
+
             uint8_t fetch();
             uint8_t fetched = 0x00;
 
@@ -74,6 +79,10 @@ namespace UnifiedEmulation {
 
             bool complete();
 
+            //Switch dispatch is the default, the lookup table path is kept for comparison
+            bool bSwitchDecode = true;
+            uint32_t nInstructionCount = 0;
+
             std::map<uint16_t, std::string> disassemble(uint16_t nStart, uint16_t nStop);
 
         private:
@@ -82,6 +91,8 @@ namespace UnifiedEmulation {
             void write(uint16_t addr, uint8_t data);
             uint8_t read(uint16_t addr, bool bReadOnly = false);
 
+            uint8_t execute();
+
             //Register Access
             uint8_t GetFlag(FLAGS6502 flag);
             void SetFlag(FLAGS6502 flag, bool val);
@@ -21,18 +21,26 @@ namespace UnifiedEmulation {
 
         public:
 	        bool ImageValid();
+            const std::string& GetFileName() { return sFileName; }
 
         private:
 	        bool bImageValid = false;
+            std::string sFileName;
             MIRROR hw_mirror = HORIZONTAL;
 
             std::vector<uint8_t> vPRGMemory;
             std::vector<uint8_t> vCHRMemory;
 
+            //Extra 2KB of nametable ram on four screen boards
+            std::vector<uint8_t> vVRAM;
+
             uint8_t nMapperID = 0;
             uint8_t nPRGBanks = 0;
             uint8_t nCHRBanks = 0;
 
+            //FNV-1a of the ROM as loaded
+            uint32_t nImageHash = 0;
+
             std::shared_ptr<Mapper> pMapper;
 
         public:
@@ -40,6 +48,9 @@ namespace UnifiedEmulation {
             bool cpuRead(uint16_t addr, uint8_t &data);
             bool cpuWrite(uint16_t addr, uint8_t data);
 
+            //Direct pointers to the 256 byte CPU page at addr, nullptr where the mapper has to handle it
+            void GetCPUPage(uint16_t addr, const uint8_t* &pRead, uint8_t* &pWrite);
+
             //Comunication with ppu bus
             bool ppuRead(uint16_t addr, uint8_t &data);
             bool ppuWrite(uint16_t addr, uint8_t data);
@@ -50,7 +61,18 @@ namespace UnifiedEmulation {
             // Get Mirror configuration
 	        MIRROR Mirror();
 
+            // Cartridge nametable ram, nullptr unless four screen
+            uint8_t* GetVRAM();
+
             std::shared_ptr<Mapper> GetMapper();
+
+            uint8_t GetMapperID() { return nMapperID; }
+            uint8_t GetPRGBanks() { return nPRGBanks; }
+            uint8_t GetCHRBanks() { return nCHRBanks; }
+            uint32_t GetImageHash() { return nImageHash; }
+
+            // Writable memory and mapper state to or from a save state, ROM is never copied
+            void Serialize(StateStream& s);
         };
     }
 }
\ No newline at end of file
@@ -4,13 +4,21 @@
 #include "./Bus/Bus.h"
 #include "./CPU/6502.h"
 #include "./PPU/2C02.h"
+#include "./APU/Resampler.h"
+#include "./APU/OutputFilter.h"
 #include "./SoundPacer.h"
+#include "./Rewind.h"
 #include "../Controller.h"
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <list>
 #include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 namespace UnifiedEmulation {
     namespace NES {
@@ -36,12 +44,13 @@ namespace UnifiedEmulation {
             bool DebugMode = false;
             DebugConfig Debug;
         public:
-            NESEmulator(Game* game, string FontFileLocation)
-                : PaletteSelector(ivec2(28, 10), vec3(1)), ImagePixel(ivec2(360, 240)), RomSelector(ivec2(5, 5), vec3(1)), font(FontFileLocation.c_str(), 8)
+            //AudioOut picks where sound goes, empty for the audio device, "null" to discard it or a file name to record it as wav
+            NESEmulator(Game* game, string FontFileLocation, Bus::RUNMODE RunMode = Bus::RUN_CATCHUP, string AudioOut = "")
+                : PaletteSelector(ivec2(28, 10), vec3(1)), ImagePixel(ivec2(360, 240)), RomSelector(ivec2(5, 5), vec3(1)), Screen(ivec2(256, 240)), font(FontFileLocation.c_str(), 8)
             {
                 this->system = new Bus;
+                this->system->SetRunMode(RunMode);
                 this->game = game;
-                this->PlayAudio = new bool(false);
 
                 this->Button_Pressed = 0;
                 this->lastKey = Key_N;
@@ -59,6 +68,11 @@ namespace UnifiedEmulation {
 
                 //Reset
                 this->system->reset();
+                this->Rewind.Start(*this->system);
+                this->StartAheadSystem();
+
+                //Custom Palette
+                this->LoadCustomPalette(*this->system);
 
                 //Create Palette Selector Image
                 for (int y = 0; y < 6; y++){
@@ -67,25 +81,30 @@ namespace UnifiedEmulation {
                     }
                 }
 
-                for (int i = 0; i < 4; i++)
-                {			
-                    for (int j = 0; j < 120; j++)
-                        this->audioV[i].push_back(0);
-                }
+                this->Audios = new PixelImage(ivec2(250, 120));
 
-                this->Audios = new PixelImage(ivec2(120, 120));
+                //The device may settle on a different rate than asked for, resample to whatever it runs at
+                //Without a device the emulator still runs, the sound just goes nowhere
+                bool bSinkOpen = false;
+                if(!AudioOut.empty() && AudioOut != "null"){
+                    bSinkOpen = this->SoundDriver.InitialiseSink(std::make_unique<WavSink>(AudioOut), this->nSampleRate, 1);
+                    if(!bSinkOpen)
+                        std::cout << "Could not open " << AudioOut << std::endl;
+                }
+                if(!bSinkOpen && (AudioOut == "null" || !this->SoundDriver.InitialiseAudio(this->nSampleRate, 1)))
+                    this->SoundDriver.InitialiseSink(std::make_unique<NullSink>(), this->nSampleRate, 1);
+                this->nSampleRate = this->SoundDriver.m_nSampleRate;
+                this->Resample.SetRates(Bus::GetSampleRate(), this->nSampleRate);
+                this->Filter.SetRate(Bus::GetSampleRate());
 
-                this->emulatorPointer = this;
-                this->system->SetSampleFrequency(44100);
-                
-                this->SoundDriver.InitialiseAudio(44100, 1, 8, 512);
-                this->SoundDriver.SetUserSynthFunction(SoundOut);
+                this->StartEmulation();
             }
 
             ~NESEmulator(){
+                this->StopEmulation();
+                delete this->pAhead;
                 delete this->system;
-                if(PlayAudio)
-                    this->SoundDriver.DestroyAudio();
+                this->SoundDriver.DestroyAudio();
             }
         
         public:
@@ -93,8 +112,6 @@ namespace UnifiedEmulation {
 
             std::shared_ptr<Cartridge> cart;
             EmulationSound SoundDriver;
-            
-            static NESEmulator* emulatorPointer;
 
         private:
             Game* game;
@@ -102,9 +119,12 @@ namespace UnifiedEmulation {
             PixelImage PaletteSelector;
             PixelImage ImagePixel;
             PixelImage RomSelector;
+            //Last finished frame, copied out between frames so presentation never reads the PPU
+            PixelImage Screen;
 
             PixelImage* Audios;
             vector<vector<PixelImage*>> Pals;
+            PixelImage PatternTables[2]{PixelImage(ivec2(128, 128)), PixelImage(ivec2(128, 128))};
 
             Font font;
 
@@ -121,10 +141,12 @@ namespace UnifiedEmulation {
 
             bool ToggleExtraController = false;
 
-            static bool* PlayAudio;
+            //Read by the emulation thread every sample
+            std::atomic<bool> PlayAudio{false};
 
         public:
             int ClockSpeed = 0;
+            int InstructionSpeed = 0;
             int CurrentFrame = 0;
 
             int CurrentRom = 0;
@@ -143,7 +165,9 @@ namespace UnifiedEmulation {
 
             std::map<uint16_t, std::string> mapAsm;
 
-            list<uint16_t> audioV[4];
+            //Quick save slot, only grows when a cartridge needs more room than the last
+            vector<uint8_t> QuickState;
+            size_t nQuickStateSize = 0;
 
         private:
             std::vector<std::filesystem::path> GetRoms(){
@@ -171,6 +195,12 @@ namespace UnifiedEmulation {
             };
 
         private: //Drawing
+            //Pattern table in the selected palette, copied out of the core
+            PixelImage& PatternTable(uint8_t i){
+                this->PatternTables[i].CopyRGBA(this->system->ppu.GetPatternTable(i, this->nSelectedPalette));
+                return this->PatternTables[i];
+            }
+
             void DrawImage(PixelImage& i, vec2 pos, string name){
                 Image* ImageFound = nullptr;
                 bool found = false;
@@ -253,8 +283,8 @@ namespace UnifiedEmulation {
                 case Debug_Paletts:
                     for (int p = 0; p < 8; p++){
                         for(int s = 0; s < 4; s++){
-                            vec3 color = this->system->ppu.GetColorFromPaletteRam(p, s);
-                            color = vec3(color.x / 255.f, color.y / 255.f, color.z / 255.f);
+                            uint32_t rgba = this->system->ppu.GetColorFromPaletteRam(p, s);
+                            vec3 color = vec3((rgba & 0xFF) / 255.f, ((rgba >> 8) & 0xFF) / 255.f, ((rgba >> 16) & 0xFF) / 255.f);
 
                             if(this->Pals.size() < p + 1){
                                 this->Pals.push_back(vector<PixelImage*>{});
@@ -270,8 +300,8 @@ namespace UnifiedEmulation {
 
                     this->DrawImage(this->PaletteSelector, ivec2(Section1Pos.x + this->nSelectedPalette * (nSwatchSize * 5) - 2, Section1Pos.y+17), "PalSelector");
 
-                    this->DrawImage(this->system->ppu.GetPatternTable(0, this->nSelectedPalette), ivec2(Section1Pos.x, Section1Pos.y+148), "PT1");
-                    this->DrawImage(this->system->ppu.GetPatternTable(1, this->nSelectedPalette), ivec2(Section1Pos.x+130, Section1Pos.y+148), "PT2");
+                    this->DrawImage(this->PatternTable(0), ivec2(Section1Pos.x, Section1Pos.y+148), "PT1");
+                    this->DrawImage(this->PatternTable(1), ivec2(Section1Pos.x+130, Section1Pos.y+148), "PT2");
                     break;
 
                 case Debug_Sprites:
@@ -285,23 +315,7 @@ namespace UnifiedEmulation {
                     break;
                 
                 case Debug_Audio:
-                    this->Audios->Configure(ivec2(250, 120), vec3(0));
-                    //if (CurrentFrame % static_cast<int>(1 / Time.deltaTime) == 0){
-                        this->audioV[0].pop_front();
-                        this->audioV[0].push_back(this->system->apu.pulse1_visual);
-                        this->audioV[1].pop_front();
-                        this->audioV[1].push_back(this->system->apu.pulse2_visual);
-                        this->audioV[2].pop_front();
-                        this->audioV[2].push_back(this->system->apu.noise_visual);
-                        this->audioV[3].pop_front();
-                        this->audioV[3].push_back(this->system->apu.triangle_visual);
-                    //}
-                    DrawAudio(1, Section1Pos.x, 0);
-                    DrawAudio(2, Section1Pos.x, 0);
-                    DrawAudio(3, Section1Pos.x, 0);
-                    DrawAudio(4, Section1Pos.x, 0);
-
-                    this->DrawImage(*this->Audios, ivec2(Section1Pos.x, Section1Pos.y + 120), "Audio" + to_string(0));
+                    this->DrawScope(Section1Pos);
                     break;
 
                 case Debug_None:
@@ -325,8 +339,8 @@ namespace UnifiedEmulation {
                 case Debug_Paletts:
                     for (int p = 0; p < 8; p++){
                         for(int s = 0; s < 4; s++){
-                            vec3 color = this->system->ppu.GetColorFromPaletteRam(p, s);
-                            color = vec3(color.x / 255.f, color.y / 255.f, color.z / 255.f);
+                            uint32_t rgba = this->system->ppu.GetColorFromPaletteRam(p, s);
+                            vec3 color = vec3((rgba & 0xFF) / 255.f, ((rgba >> 8) & 0xFF) / 255.f, ((rgba >> 16) & 0xFF) / 255.f);
 
                             if(this->Pals.size() < p + 1){
                                 this->Pals.push_back(vector<PixelImage*>{});
@@ -342,8 +356,8 @@ namespace UnifiedEmulation {
 
                     this->DrawImage(this->PaletteSelector, ivec2(Section2Pos.x + this->nSelectedPalette * (nSwatchSize * 5) - 2, Section2Pos.y+17), "PalSelector");
 
-                    this->DrawImage(this->system->ppu.GetPatternTable(0, this->nSelectedPalette), ivec2(Section2Pos.x, Section2Pos.y+148), "PT1");
-                    this->DrawImage(this->system->ppu.GetPatternTable(1, this->nSelectedPalette), ivec2(Section2Pos.x+130, Section2Pos.y+148), "PT2");
+                    this->DrawImage(this->PatternTable(0), ivec2(Section2Pos.x, Section2Pos.y+148), "PT1");
+                    this->DrawImage(this->PatternTable(1), ivec2(Section2Pos.x+130, Section2Pos.y+148), "PT2");
                     break;
 
                 case Debug_Sprites:
@@ -357,23 +371,7 @@ namespace UnifiedEmulation {
                     break;
 
                 case Debug_Audio:
-                    this->Audios->Configure(ivec2(250, 120), vec3(0));
-                    //if (CurrentFrame % static_cast<int>(1 / Time.deltaTime) == 0){
-                        this->audioV[0].pop_front();
-                        this->audioV[0].push_back(this->system->apu.pulse1_visual);
-                        this->audioV[1].pop_front();
-                        this->audioV[1].push_back(this->system->apu.pulse2_visual);
-                        this->audioV[2].pop_front();
-                        this->audioV[2].push_back(this->system->apu.noise_visual);
-                        this->audioV[3].pop_front();
-                        this->audioV[3].push_back(this->system->apu.triangle_visual);
-                    //}
-                    DrawAudio(1, Section2Pos.x, 0);
-                    DrawAudio(2, Section2Pos.x, 0);
-                    DrawAudio(3, Section2Pos.x, 0);
-                    DrawAudio(4, Section2Pos.x, 0);
-
-                    this->DrawImage(*this->Audios, ivec2(Section2Pos.x, Section2Pos.y + 120), "Audio" + to_string(0));
+                    this->DrawScope(Section2Pos);
                     break;
 
                 case Debug_None:
@@ -397,8 +395,8 @@ namespace UnifiedEmulation {
                 case Debug_Paletts:
                     for (int p = 0; p < 8; p++){
                         for(int s = 0; s < 4; s++){
-                            vec3 color = this->system->ppu.GetColorFromPaletteRam(p, s);
-                            color = vec3(color.x / 255.f, color.y / 255.f, color.z / 255.f);
+                            uint32_t rgba = this->system->ppu.GetColorFromPaletteRam(p, s);
+                            vec3 color = vec3((rgba & 0xFF) / 255.f, ((rgba >> 8) & 0xFF) / 255.f, ((rgba >> 16) & 0xFF) / 255.f);
 
                             if(this->Pals.size() < p + 1){
                                 this->Pals.push_back(vector<PixelImage*>{});
@@ -414,8 +412,8 @@ namespace UnifiedEmulation {
 
                     this->DrawImage(this->PaletteSelector, ivec2(Section3Pos.x + this->nSelectedPalette * (nSwatchSize * 5) - 2, Section3Pos.y+17), "PalSelector");
 
-                    this->DrawImage(this->system->ppu.GetPatternTable(0, this->nSelectedPalette), ivec2(Section3Pos.x, Section3Pos.y+148), "PT1");
-                    this->DrawImage(this->system->ppu.GetPatternTable(1, this->nSelectedPalette), ivec2(Section3Pos.x+130, Section3Pos.y+148), "PT2");
+                    this->DrawImage(this->PatternTable(0), ivec2(Section3Pos.x, Section3Pos.y+148), "PT1");
+                    this->DrawImage(this->PatternTable(1), ivec2(Section3Pos.x+130, Section3Pos.y+148), "PT2");
                     break;
 
                 case Debug_Sprites:
@@ -429,23 +427,7 @@ namespace UnifiedEmulation {
                     break;
 
                 case Debug_Audio:
-                    this->Audios->Configure(ivec2(250, 120), vec3(0));
-                    //if (CurrentFrame % static_cast<int>(1 / Time.deltaTime) == 0){
-                        this->audioV[0].pop_front();
-                        this->audioV[0].push_back(this->system->apu.pulse1_visual);
-                        this->audioV[1].pop_front();
-                        this->audioV[1].push_back(this->system->apu.pulse2_visual);
-                        this->audioV[2].pop_front();
-                        this->audioV[2].push_back(this->system->apu.noise_visual);
-                        this->audioV[3].pop_front();
-                        this->audioV[3].push_back(this->system->apu.triangle_visual);
-                    //}
-                    DrawAudio(1, Section3Pos.x, 0);
-                    DrawAudio(2, Section3Pos.x, 0);
-                    DrawAudio(3, Section3Pos.x, 0);
-                    DrawAudio(4, Section3Pos.x, 0);
-
-                    this->DrawImage(*this->Audios, ivec2(Section3Pos.x, Section3Pos.y + 120), "Audio" + to_string(0));
+                    this->DrawScope(Section3Pos);
                     break;
 
                 case Debug_None:
@@ -453,33 +435,43 @@ namespace UnifiedEmulation {
                 }
             }
 
-            void DrawAudio(int Channel, int x, int y){
-                int i = 0;
-                for (auto s : this->audioV[Channel-1]){
-                    //cout << "I: " << i << "X: " << x + i << " Y: " << y + (s >> (Channel-1 == 2 ? 5 : 4)) << endl;
+            //One lane per apu channel drawn from the levels it has recorded, the image is kept and cleared in place
+            void DrawScope(vec2 Pos){
+                static const uint32_t Colors[APU2A03::nScopeChannels] = {
+                    PixelImage::PackRGBA(255, 255, 255),
+                    PixelImage::PackRGBA(255, 0, 0),
+                    PixelImage::PackRGBA(0, 128, 255),
+                    PixelImage::PackRGBA(0, 255, 0),
+                };
+
+                const int Width = this->Audios->Size.x;
+                const int Lane = this->Audios->Size.y / APU2A03::nScopeChannels;
+                APU2A03& apu = this->system->apu;
+
+                this->Audios->Configure(this->Audios->Size, vec3(0));
+
+                for (int c = 0; c < APU2A03::nScopeChannels; c++){
+                    //Start on the latest rising edge that leaves a full width to draw, so a steady tone stands still
+                    uint32_t nStart = Width - 1;
+                    for (uint32_t n = Width; n < 2u * Width && n < APU2A03::nScopeSize; n++)
+                        if (apu.GetScopeLevel(c, n) < apu.GetScopeLevel(c, n - 1)){
+                            nStart = n - 1;
+                            break;
+                        }
 
-                    vec3 Color = vec3(1);
+                    int nLast = -1;
+                    for (int x = 0; x < Width; x++){
+                        int y = Lane * (c + 1) - 2 - apu.GetScopeLevel(c, nStart - x) * (Lane - 4) / 15;
 
-                    switch (Channel){
-                        default:
-                            this->Audios->SetPixel(ivec2(i, y + (s >> (Channel-1 == 2 ? 5 : 4))), vec4(Color, 1));
-                            break;
-                        case 2:
-                            Color = vec3(1, 0, 0);
-                            this->Audios->SetPixel(ivec2(i, y + (s >> (Channel-1 == 2 ? 5 : 4))), vec4(Color, 1));
-                            break;
-                        case 3:
-                            Color = vec3(0, 1, 0);
-                            this->Audios->SetPixel(ivec2(i + 130, y + (s >> (Channel-1 == 2 ? 5 : 4))), vec4(Color, 1));
-                            break;
-                        case 4:
-                            Color = vec3(0, 0.5f, 1);
-                            this->Audios->SetPixel(ivec2(i + 130, y + (s >> (Channel-1 == 2 ? 5 : 4))), vec4(Color, 1));
-                            break;
+                        //Join each point to the last so the edges of a square wave are drawn
+                        int y0 = nLast < 0 ? y : nLast;
+                        for (int yy = std::min(y, y0); yy <= std::max(y, y0); yy++)
+                            this->Audios->SetPixelRGBA(ivec2(x, yy), Colors[c]);
+                        nLast = y;
                     }
-
-                    i++;
                 }
+
+                this->DrawImage(*this->Audios, ivec2(Pos.x, Pos.y + 120), "Audio0");
             }
 
             void DrawRam(int x, int y, uint16_t nAddr, int nRows, int nColumns)
@@ -521,6 +513,12 @@ namespace UnifiedEmulation {
                 DrawString(vec2(x , y + 80), "APU Clock Speed: " + to_string(ClockSpeed), vec3(1), "APUClockSpeed");
 
                 DrawString(vec2(x , y + 90), "Clock: " + to_string(system->SystemClockCount), vec3(1), "ClockCount");
+                DrawString(vec2(x , y + 100), "Instructions: " + to_string(InstructionSpeed) + (system->cpu.bSwitchDecode ? " [Switch]" : " [Lookup]"), vec3(1), "InstructionSpeed");
+                DrawString(vec2(x , y + 120), "Audio: " + to_string((int)this->SoundDriver.GetLatencyMs()) + "ms " + to_string(this->SoundDriver.GetQueueTarget()) + "x" + to_string(this->SoundDriver.GetBlockSamples())
+                    + " Underruns: " + to_string(this->SoundDriver.GetDeviceUnderruns()) + "/" + to_string(this->SoundDriver.GetUnderruns()), vec3(1), "AudioLatency");
+                DrawString(vec2(x , y + 130), "Rewind: " + to_string(Rewind.GetFrames() / 60) + "s " + to_string(Rewind.GetBytesUsed() >> 10) + "KB"
+                    + (Rewind.GetDropped() ? " Dropped: " + to_string(Rewind.GetDropped()) : ""), vec3(1), "Rewind");
+                DrawString(vec2(x , y + 110), "Run Mode: " + string(system->GetRunMode() == Bus::RUN_DOT ? "Dot" : system->GetRunMode() == Bus::RUN_CATCHUP ? "Catch Up" : (system->LockstepDiverged() ? "Lockstep [Diverged]" : "Lockstep")) + (system->ppu.bBatchRender ? " [Batched]" : ""), vec3(1), "RunMode");
             }
 
             void DrawCode(int x, int y, int nLines)
@@ -566,19 +564,264 @@ namespace UnifiedEmulation {
 
         private:
 
-            static float SoundOut(int nChannel, float fGlobalTime, float fTimeStep){
-                if (nChannel == 0){
-                    while (!emulatorPointer->system->clock()) {};
-                    if(*PlayAudio)
-                        return static_cast<float>(emulatorPointer->system->dAudioSample);
+            //Samples produced between writes to the audio ring
+            static const size_t nAudioBlock = 256;
+            float fAudioBlock[nAudioBlock];
+
+            //Console output filters, run at the apu rate
+            OutputFilter Filter;
+
+            //Apu rate to device rate, room for a block going up to 192kHz
+            Resampler Resample;
+            static const size_t nResampledSize = 4 * nAudioBlock;
+            float fResampled[nResampledSize];
+            size_t nAudioBlockFill = 0;
+
+            //Emulation runs whole frames on its own thread, the main thread only touches the system between frames
+            std::thread EmulationThread;
+            std::atomic<bool> bEmulationActive{false};
+            std::mutex muxSystem;
+
+            //Every frame is kept for stepping back through while BACKSPACE is held
+            RewindBuffer Rewind;
+            std::atomic<bool> bRewinding{false};
+
+            //Frames run ahead of the real system for the one shown, so input shows up that much sooner
+            int nRunAhead = 0;
+            //Snapshot the frames ahead are run from
+            vector<uint8_t> AheadState;
+            size_t nAheadStateSize = 0;
+
+            //With a second system the frames ahead run on their own thread, the real one never waits for them
+            Bus* pAhead = nullptr;
+            //Asked for a second system, it is made once there is a cartridge for it to run
+            bool bAheadSecondSystem = false;
+            std::thread AheadThread;
+            std::mutex muxAhead;
+            std::mutex muxAheadBus;
+            std::condition_variable cvAhead;
+            bool bAheadJob = false;
+            bool bAheadReady = false;
+            uint8_t nAheadController[2] = {};
+            int nAheadFrames = 0;
+            PixelImage AheadScreen{ivec2(256, 240)};
+
+            //Output rate the device was opened at and the trim the rate controller has applied to it
+            unsigned int nSampleRate = 48000;
+            double dSampleRatio = 1.0;
+
+            //Furthest the rate controller moves the sample clock from the device rate
+            static constexpr double dMaxRateTrim = 0.005;
+
+            void StartEmulation(){
+                this->bEmulationActive = true;
+                this->EmulationThread = std::thread(&NESEmulator::EmulationLoop, this);
+            }
+
+            void StopEmulation(){
+                this->bEmulationActive = false;
+                if(this->EmulationThread.joinable())
+                    this->EmulationThread.join();
+
+                cvAhead.notify_all();
+                if(this->AheadThread.joinable())
+                    this->AheadThread.join();
+            }
+
+            //Run to the end of the frame with nothing going to the audio, for frames that are thrown away
+            static void RunFrameSilent(Bus* pBus){
+                uint32_t nFrame = pBus->ppu.frame_count;
+                while (pBus->ppu.frame_count == nFrame)
+                    pBus->clock();
+                pBus->DiscardAudio();
+            }
+
+            //Show the frame nRunAhead on from here with the controllers held as they are, the real system carries on from where it was
+            void RunAhead(){
+                if (this->pAhead){
+                    {
+                        std::lock_guard<std::mutex> lock(this->muxAhead);
+                        if (this->bAheadJob)
+                            return;
+
+                        this->AheadState.resize(std::max(this->AheadState.size(), this->system->GetStateSize()));
+                        this->nAheadStateSize = this->system->SaveState(this->AheadState.data(), this->AheadState.size());
+                        this->nAheadController[0] = this->system->controller[0];
+                        this->nAheadController[1] = this->system->controller[1];
+                        this->nAheadFrames = this->nRunAhead;
+                        this->bAheadJob = this->nAheadStateSize > 0;
+                    }
+                    this->cvAhead.notify_one();
+                    return;
+                }
+
+                this->AheadState.resize(std::max(this->AheadState.size(), this->system->GetStateSize()));
+                this->nAheadStateSize = this->system->SaveState(this->AheadState.data(), this->AheadState.size());
+                if (this->nAheadStateSize == 0)
+                    return;
+
+                //The last frame run is left in the PPU's screen for Update to pick up
+                for (int i = 0; i < this->nRunAhead; i++)
+                    RunFrameSilent(this->system);
+
+                this->system->LoadState(this->AheadState.data(), this->nAheadStateSize);
+            }
+
+            //Both systems draw with the same palette
+            static constexpr const char* sPaletteFile = "./rsc/Palettes/NES.pal";
+            void LoadCustomPalette(Bus& bus){
+                if(std::filesystem::exists(sPaletteFile))
+                    bus.ppu.LoadPalette(sPaletteFile);
+            }
+
+            //The second system runs a copy of the real system's cartridge, made the first time there is one and swapped with it after
+            void StartAheadSystem(){
+                if(!this->system->cart)
+                    return;
+
+                if(this->pAhead){
+                    std::lock_guard<std::mutex> busLock(this->muxAheadBus);
+                    this->pAhead->insertCartridge(std::make_shared<Cartridge>(this->system->cart->GetFileName()));
+                    this->pAhead->reset();
+                    this->LoadCustomPalette(*this->pAhead);
+                }
+                else if(this->bAheadSecondSystem && this->nRunAhead > 0){
+                    this->pAhead = new Bus();
+                    this->pAhead->insertCartridge(std::make_shared<Cartridge>(this->system->cart->GetFileName()));
+                    this->pAhead->reset();
+                    this->LoadCustomPalette(*this->pAhead);
+                    this->AheadThread = std::thread(&NESEmulator::AheadLoop, this);
+                }
+            }
+
+            void AheadLoop(){
+                while (this->bEmulationActive){
+                    std::unique_lock<std::mutex> lock(this->muxAhead);
+                    this->cvAhead.wait_for(lock, std::chrono::milliseconds(50), [&]() { return this->bAheadJob || !this->bEmulationActive; });
+                    if (!this->bAheadJob)
+                        continue;
+                    int nFrames = this->nAheadFrames;
+                    lock.unlock();
+
+                    //The job buffer is left alone by the emulation thread until the job is cleared
+                    bool bRan = false;
+                    {
+                        std::lock_guard<std::mutex> busLock(this->muxAheadBus);
+                        if (this->pAhead->LoadState(this->AheadState.data(), this->nAheadStateSize)){
+                            this->pAhead->controller[0] = this->nAheadController[0];
+                            this->pAhead->controller[1] = this->nAheadController[1];
+                            for (int i = 0; i < nFrames; i++)
+                                RunFrameSilent(this->pAhead);
+                            bRan = true;
+                        }
+                    }
+
+                    lock.lock();
+                    if (bRan){
+                        this->AheadScreen.CopyRGBA(this->pAhead->ppu.GetScreen());
+                        this->bAheadReady = true;
+                    }
+                    this->bAheadJob = false;
+                }
+            }
+
+            //Run the system up to the end of the current frame, then hand its samples to the audio ring in blocks
+            //Muted frames still hand over silence so the audio keeps its pace
+            void RunFrame(bool bMute = false){
+                uint32_t nFrame = this->system->ppu.frame_count;
+                while (this->system->ppu.frame_count == nFrame)
+                    this->system->clock();
+
+                while (true){
+                    size_t nRead = this->system->ReadAudio(this->fAudioBlock + this->nAudioBlockFill, nAudioBlock - this->nAudioBlockFill);
+                    if (nRead == 0)
+                        break;
+
+                    if (!this->PlayAudio || bMute)
+                        std::fill(this->fAudioBlock + this->nAudioBlockFill, this->fAudioBlock + this->nAudioBlockFill + nRead, 0.0f);
+
+                    this->nAudioBlockFill += nRead;
+                    if (this->nAudioBlockFill == nAudioBlock){
+                        this->Filter.Process(this->fAudioBlock, nAudioBlock);
+                        size_t nOut = this->Resample.Process(this->fAudioBlock, nAudioBlock, this->fResampled, nResampledSize);
+                        this->SoundDriver.m_Ring.Write(this->fResampled, nOut);
+                        this->nAudioBlockFill = 0;
+                    }
+                }
+            }
+
+            //Hold the audio ring at its target by trimming the resampling ratio, a filling ring gets fewer samples per frame
+            void UpdateRateControl(){
+                double dTarget = (double)this->SoundDriver.GetRingTarget();
+                double dError = ((double)this->SoundDriver.m_Ring.Available() - dTarget) / dTarget;
+                dError = std::min(std::max(dError, -1.0), 1.0);
+
+                this->dSampleRatio = 1.0 - dMaxRateTrim * dError;
+                this->Resample.SetRatio(this->dSampleRatio);
+            }
+
+            void EmulationLoop(){
+                using clock = std::chrono::steady_clock;
+
+                //Sinks have no clock of their own, so there is nothing for the rate controller to follow
+                bool bDeviceDriven = this->SoundDriver.IsDeviceDriven();
+
+                //One NTSC frame is 89341.5 master clocks
+                const auto tFrame = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(89341.5 / 5369318.0));
+                auto tNext = clock::now();
+
+                while (this->bEmulationActive){
+                    {
+                        std::lock_guard<std::mutex> lock(this->muxSystem);
+                        if (this->system->cart){
+                            //Stepping back shows each earlier frame by running it again from the one before
+                            if (this->bRewinding){
+                                if (this->Rewind.StepBack(*this->system))
+                                    this->RunFrame(true);
+                            }
+                            else{
+                                this->RunFrame();
+                                this->Rewind.Push(*this->system);
+
+                                if (this->nRunAhead > 0)
+                                    this->RunAhead();
+                            }
+
+                            if (bDeviceDriven)
+                                this->UpdateRateControl();
+                            else
+                                this->SoundDriver.Pump();
+                        }
+                    }
+
+                    //Frames keep to the video rate, the ring running low after a stall is refilled straight away
+                    tNext += tFrame;
+                    auto tNow = clock::now();
+                    bool bRefill = bDeviceDriven && this->SoundDriver.m_Ring.Available() < this->SoundDriver.GetRingTarget() / 2;
+                    if (tNext < tNow - 4 * tFrame || bRefill)
+                        tNext = tNow;
                     else
-                        return 0.0f;
+                        std::this_thread::sleep_until(tNext);
                 }
-                else
-                    return 0.0f;
             }
 
         public:
+            //Show every frame nFrames ahead of the real system, on a second system and thread if bSecondSystem
+            void SetRunAhead(int nFrames, bool bSecondSystem = false){
+                std::lock_guard<std::mutex> lock(this->muxSystem);
+                this->nRunAhead = std::max(nFrames, 0);
+                this->bAheadSecondSystem = bSecondSystem;
+
+                //Nothing runs ahead any more, so the last frame from the second system must not keep being shown
+                if(this->nRunAhead == 0){
+                    std::lock_guard<std::mutex> aheadLock(this->muxAhead);
+                    this->bAheadReady = false;
+                }
+
+                if(this->pAhead == nullptr)
+                    this->StartAheadSystem();
+            }
+
             void UpdateController(int id = 0){
                 // Handle input for controller in port #1
                 this->system->controller[id] = 0x00;
@@ -595,10 +838,15 @@ namespace UnifiedEmulation {
             }
 
             void Update(){
+                //Input and debug views run between emulated frames
+                std::lock_guard<std::mutex> lock(this->muxSystem);
+
                 this->CurrentFrame++;
 
                 UpdateController(0);
 
+                this->bRewinding = this->game->Input.Keyboard.KeyPressed(Key_BACKSPACE);
+
                 if(this->ToggleExtraController)
                     UpdateController(1);               
 
@@ -612,6 +860,31 @@ namespace UnifiedEmulation {
                     this->lastKey = Key_0;
                 }
 
+                if(this->game->Input.Keyboard.KeyPressed(Key_F5) && !this->Button_Pressed){
+                    this->QuickState.resize(std::max(this->QuickState.size(), this->system->GetStateSize()));
+                    this->nQuickStateSize = this->system->SaveState(this->QuickState.data(), this->QuickState.size());
+                    std::cout << "State saved (" << this->nQuickStateSize << " bytes)" << std::endl;
+                    this->Button_Pressed = true;
+                    this->lastKey = Key_F5;
+                }
+                else if(!this->game->Input.Keyboard.KeyPressed(Key_F5) && this->Button_Pressed && this->lastKey == Key_F5){
+                    this->Button_Pressed = false;
+                    this->lastKey = Key_0;
+                }
+
+                if(this->game->Input.Keyboard.KeyPressed(Key_F9) && !this->Button_Pressed){
+                    if(this->nQuickStateSize > 0 && this->system->LoadState(this->QuickState.data(), this->nQuickStateSize))
+                        std::cout << "State loaded" << std::endl;
+                    else
+                        std::cout << "No state saved for this ROM" << std::endl;
+                    this->Button_Pressed = true;
+                    this->lastKey = Key_F9;
+                }
+                else if(!this->game->Input.Keyboard.KeyPressed(Key_F9) && this->Button_Pressed && this->lastKey == Key_F9){
+                    this->Button_Pressed = false;
+                    this->lastKey = Key_0;
+                }
+
                 if(this->DebugMode)
                     if(this->game->Input.Keyboard.KeyPressed(Key_P) && !this->Button_Pressed){
                         (++this->nSelectedPalette) &= 0x07;
@@ -635,6 +908,8 @@ namespace UnifiedEmulation {
                         this->system->insertCartridge(cart);
 
                         this->system->reset();
+                        this->Rewind.Start(*this->system);
+                        this->StartAheadSystem();
 
                         this->Button_Pressed = true;
                         this->lastKey = Key_N;
@@ -645,6 +920,28 @@ namespace UnifiedEmulation {
                     }
                 }
 
+                if(this->DebugMode)
+                    if(this->game->Input.Keyboard.KeyPressed(Key_D) && !this->Button_Pressed){
+                        this->system->cpu.bSwitchDecode = !this->system->cpu.bSwitchDecode;
+                        this->Button_Pressed = true;
+                        this->lastKey = Key_D;
+                    }
+                    else if(!this->game->Input.Keyboard.KeyPressed(Key_D) && this->Button_Pressed && this->lastKey == Key_D){
+                        this->Button_Pressed = false;
+                        this->lastKey = Key_0;
+                    }
+
+                if(this->DebugMode)
+                    if(this->game->Input.Keyboard.KeyPressed(Key_B) && !this->Button_Pressed){
+                        this->system->ppu.bBatchRender = !this->system->ppu.bBatchRender;
+                        this->Button_Pressed = true;
+                        this->lastKey = Key_B;
+                    }
+                    else if(!this->game->Input.Keyboard.KeyPressed(Key_B) && this->Button_Pressed && this->lastKey == Key_B){
+                        this->Button_Pressed = false;
+                        this->lastKey = Key_0;
+                    }
+
                 if(this->DebugMode){
                     if(this->game->Input.Keyboard.KeyPressed(Key_PAGE_UP) && !this->Button_Pressed && this->current_scale <= 2){
                         this->game->window.Size *= 2;
@@ -673,23 +970,33 @@ namespace UnifiedEmulation {
                     if(this->CurrentFrame % 1/Time.deltaTime == 0){
                         this->ClockSpeed = this->system->ClockSpeedCounter;
                         this->system->ClockSpeedCounter = 0;
+                        this->InstructionSpeed = this->system->cpu.nInstructionCount;
+                        this->system->cpu.nInstructionCount = 0;
                     }
                 this->cartChangeInterval++;
+
+                this->Screen.CopyRGBA(this->system->ppu.GetScreen());
+
+                //Frames from the second system replace the real one once it has caught up
+                if(this->pAhead && this->nRunAhead > 0){
+                    std::lock_guard<std::mutex> aheadLock(this->muxAhead);
+                    if(this->bRewinding)
+                        this->bAheadReady = false;
+                    else if(this->bAheadReady)
+                        this->Screen = this->AheadScreen;
+                }
                 
                 if(this->DebugMode)
                     this->DrawDebug();
-                    this->DrawImage(this->system->ppu.GetScreen(), ivec2(0, 475), "MainView");
+                    this->DrawImage(this->Screen, ivec2(0, 475), "MainView");
             }
 
             void Render(){
                 if(this->DebugMode)
                     this->game->Render();
                 else
-		            this->game->Render(&this->system->ppu.GetScreen(), 4);
+		            this->game->Render(&this->Screen, 4);
             }
         };
-
-        NESEmulator* NESEmulator::emulatorPointer = nullptr;
-        bool* NESEmulator::PlayAudio = nullptr;
     }
 }
\ No newline at end of file
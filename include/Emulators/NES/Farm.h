@@ -0,0 +1,264 @@
+#pragma once
+
+//Includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bus/Bus.h"
+#include "APU/OutputFilter.h"
+#include "APU/Resampler.h"
+#include "AudioSink.h"
+
+namespace UnifiedEmulation
+{
+    namespace NES{
+        //Many independent systems run a frame at a time across a pool of threads, with no window or audio device
+        //Each worker takes frames from its own queue and steals from the others once it runs out
+        class EmulationFarm{
+        public:
+            //Called on a worker thread before a frame runs, set the controllers from here
+            typedef std::function<void(Bus& system, uint64_t nFrame)> InputFunction;
+            //Called on a worker thread with the finished frame, nScreenWidth x nScreenHeight packed pixels
+            typedef std::function<void(const uint32_t* pScreen, uint64_t nFrame)> FrameFunction;
+
+            EmulationFarm(unsigned int nThreads = std::thread::hardware_concurrency()){
+                nThreads = std::max(1u, nThreads);
+                for (unsigned int i = 0; i < nThreads; i++)
+                    vWorkers.push_back(std::make_unique<Worker>());
+
+                bActive = true;
+                for (unsigned int i = 0; i < nThreads; i++)
+                    vThreads.emplace_back(&EmulationFarm::WorkerLoop, this, i);
+            }
+
+            ~EmulationFarm(){
+                {
+                    std::lock_guard<std::mutex> lock(muxWake);
+                    bActive = false;
+                }
+                cvWake.notify_all();
+                for (auto& t : vThreads)
+                    t.join();
+
+                for (auto& c : vConsoles)
+                    if (c->pSink)
+                        c->pSink->Close();
+            }
+
+            //Returns the index of the new system, or -1 if the rom could not be loaded
+            int AddConsole(const std::string& sRomFile, Bus::RUNMODE RunMode = Bus::RUN_CATCHUP){
+                std::shared_ptr<Cartridge> cart = std::make_shared<Cartridge>(sRomFile);
+                if (!cart->ImageValid())
+                    return -1;
+
+                std::unique_ptr<Console> c = std::make_unique<Console>();
+                c->system.SetRunMode(RunMode);
+                c->system.insertCartridge(cart);
+                c->system.reset();
+                c->cart = cart;
+
+                vConsoles.push_back(std::move(c));
+                return (int)vConsoles.size() - 1;
+            }
+
+            void SetInput(int n, InputFunction func) { vConsoles[n]->funcInput = func; }
+            void SetFrameSink(int n, FrameFunction func) { vConsoles[n]->funcFrame = func; }
+
+            //Sound from the system goes through the console's output stage to the sink at nSampleRate
+            bool SetAudioSink(int n, std::unique_ptr<AudioSink> pSink, unsigned int nSampleRate = 48000){
+                Console& c = *vConsoles[n];
+                if (pSink == nullptr || !pSink->Open(nSampleRate, 1))
+                    return false;
+
+                if (c.pSink)
+                    c.pSink->Close();
+                c.pSink = std::move(pSink);
+                c.Filter.SetRate(Bus::GetSampleRate());
+                c.Resample.SetRates(Bus::GetSampleRate(), nSampleRate);
+                c.nBlockFill = 0;
+                return true;
+            }
+
+            //Advance every system by nFrames, returns once they all have
+            //Not safe to call again or to add systems until it returns
+            void RunFrames(uint32_t nFrames){
+                if (nFrames == 0 || vConsoles.empty())
+                    return;
+
+                nBusy = vConsoles.size();
+                for (size_t i = 0; i < vConsoles.size(); i++){
+                    vConsoles[i]->nFramesLeft = nFrames;
+                    Worker& w = *vWorkers[i % vWorkers.size()];
+                    std::lock_guard<std::mutex> lock(w.mux);
+                    w.qWork.push_back((uint32_t)i);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(muxWake);
+                    nQueued += vConsoles.size();
+                }
+                cvWake.notify_all();
+
+                std::unique_lock<std::mutex> lock(muxDone);
+                cvDone.wait(lock, [&]() { return nBusy == 0; });
+            }
+
+            size_t GetConsoleCount() { return vConsoles.size(); }
+            unsigned int GetThreadCount() { return (unsigned int)vWorkers.size(); }
+            Bus& GetSystem(int n) { return vConsoles[n]->system; }
+            uint64_t GetFrames(int n) { return vConsoles[n]->nFrame; }
+            //Frames taken from another worker's queue
+            uint64_t GetSteals() { return nSteals; }
+
+        private:
+            struct Console{
+                Bus system;
+                std::shared_ptr<Cartridge> cart;
+                InputFunction funcInput;
+                FrameFunction funcFrame;
+
+                std::unique_ptr<AudioSink> pSink;
+                OutputFilter Filter;
+                Resampler Resample;
+                static const size_t nBlock = 512;
+                float fBlock[nBlock];
+                float fResampled[nBlock * 2];
+                size_t nBlockFill = 0;
+
+                uint64_t nFrame = 0;
+                uint32_t nFramesLeft = 0;
+
+                void RunFrame(){
+                    if (funcInput)
+                        funcInput(system, nFrame);
+
+                    uint32_t nCount = system.ppu.frame_count;
+                    while (system.ppu.frame_count == nCount)
+                        system.clock();
+
+                    //Samples the frame made go out in blocks, with no sink they are dropped
+                    if (!pSink){
+                        system.DiscardAudio();
+                    }
+                    else{
+                        size_t nRead;
+                        while ((nRead = system.ReadAudio(fBlock + nBlockFill, nBlock - nBlockFill)) > 0){
+                            nBlockFill += nRead;
+                            if (nBlockFill == nBlock){
+                                Filter.Process(fBlock, nBlock);
+                                pSink->Write(fResampled, Resample.Process(fBlock, nBlock, fResampled, nBlock * 2));
+                                nBlockFill = 0;
+                            }
+                        }
+                    }
+
+                    if (funcFrame)
+                        funcFrame(system.ppu.GetScreen(), nFrame);
+                    nFrame++;
+                }
+            };
+
+            //Newest work is taken from the back by the owner, thieves take the oldest from the front
+            struct Worker{
+                std::deque<uint32_t> qWork;
+                std::mutex mux;
+            };
+
+            std::vector<std::unique_ptr<Console>> vConsoles;
+            std::vector<std::unique_ptr<Worker>> vWorkers;
+            std::vector<std::thread> vThreads;
+
+            //Frames sitting in any queue, sleeping workers wait on it
+            std::atomic<size_t> nQueued{0};
+            std::atomic<int> nSleeping{0};
+            std::mutex muxWake;
+            std::condition_variable cvWake;
+            bool bActive = false;
+
+            //Systems still running frames in this call to RunFrames
+            std::atomic<size_t> nBusy{0};
+            std::mutex muxDone;
+            std::condition_variable cvDone;
+
+            std::atomic<uint64_t> nSteals{0};
+
+            void Push(unsigned int nWorker, uint32_t nConsole){
+                {
+                    Worker& w = *vWorkers[nWorker];
+                    std::lock_guard<std::mutex> lock(w.mux);
+                    w.qWork.push_back(nConsole);
+                }
+                nQueued++;
+
+                //Only wake a thief when one is asleep, the owner takes it next otherwise
+                if (nSleeping > 0){
+                    { std::lock_guard<std::mutex> lock(muxWake); }
+                    cvWake.notify_one();
+                }
+            }
+
+            bool Pop(unsigned int nWorker, uint32_t& nConsole){
+                Worker& w = *vWorkers[nWorker];
+                std::lock_guard<std::mutex> lock(w.mux);
+                if (w.qWork.empty())
+                    return false;
+
+                nConsole = w.qWork.back();
+                w.qWork.pop_back();
+                nQueued--;
+                return true;
+            }
+
+            bool Steal(unsigned int nWorker, uint32_t& nConsole){
+                for (size_t i = 1; i < vWorkers.size(); i++){
+                    Worker& w = *vWorkers[(nWorker + i) % vWorkers.size()];
+                    std::lock_guard<std::mutex> lock(w.mux);
+                    if (w.qWork.empty())
+                        continue;
+
+                    nConsole = w.qWork.front();
+                    w.qWork.pop_front();
+                    nQueued--;
+                    nSteals++;
+                    return true;
+                }
+                return false;
+            }
+
+            void WorkerLoop(unsigned int nWorker){
+                while (true){
+                    uint32_t nConsole;
+                    if (Pop(nWorker, nConsole) || Steal(nWorker, nConsole)){
+                        //A system only ever has one frame queued, so no two threads run it at once
+                        Console& c = *vConsoles[nConsole];
+                        c.RunFrame();
+
+                        if (--c.nFramesLeft > 0)
+                            Push(nWorker, nConsole);
+                        else if (--nBusy == 0){
+                            { std::lock_guard<std::mutex> lock(muxDone); }
+                            cvDone.notify_all();
+                        }
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lock(muxWake);
+                    nSleeping++;
+                    cvWake.wait_for(lock, std::chrono::milliseconds(50), [&]() { return nQueued > 0 || !bActive; });
+                    nSleeping--;
+                    if (!bActive)
+                        return;
+                }
+            }
+        };
+    }
+}
@@ -16,6 +16,8 @@ namespace UnifiedEmulation {
             bool ppuMapWrite(uint16_t addr, uint32_t &mapped_addr) override;
             void reset() override;
             MIRROR mirror();
+            uint8_t* GetStaticRAM(uint16_t addr) override;
+            void Serialize(StateStream& s) override;
 
         private:
             uint8_t nCHRBankSelect4Lo = 0x00;
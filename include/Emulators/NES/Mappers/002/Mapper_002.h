@@ -15,6 +15,7 @@ namespace UnifiedEmulation {
             bool ppuMapWrite(uint16_t addr, uint32_t &mapped_addr) override;
 
             void reset() override;
+            void Serialize(StateStream& s) override;
 
         private:
             uint8_t nPRGBankSelectLo = 0x00;
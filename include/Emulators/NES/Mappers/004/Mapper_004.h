@@ -21,7 +21,10 @@ namespace UnifiedEmulation{
 			void irqClear() override;
 
 			void scanline() override;
+			int irqScanlines() override;
 			MIRROR mirror() override;
+			uint8_t* GetStaticRAM(uint16_t addr) override;
+			void Serialize(StateStream& s) override;
 
 		private:
 			// Control variables
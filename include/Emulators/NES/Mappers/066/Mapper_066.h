@@ -14,6 +14,7 @@ namespace UnifiedEmulation{
 			bool ppuMapRead(uint16_t addr, uint32_t &mapped_addr) override;
 			bool ppuMapWrite(uint16_t addr, uint32_t &mapped_addr) override;
 			void reset() override;
+			void Serialize(StateStream& s) override;
 
 		private:
 			uint8_t nCHRBankSelect = 0x00;
@@ -1,5 +1,8 @@
 #pragma once
 #include <cstdint>
+#include <vector>
+
+#include "../SaveState.h"
 
 namespace UnifiedEmulation {
     namespace NES {
@@ -9,6 +12,7 @@ namespace UnifiedEmulation {
             VERTICAL,
             ONESCREEN_LO,
             ONESCREEN_HI,
+            FOURSCREEN,
         };
         class Mapper{
         public:
@@ -34,10 +38,35 @@ namespace UnifiedEmulation {
 
             // Scanline Counting
             virtual void scanline();
+            // Scanline calls until the IRQ is raised, -1 if it will not be
+            virtual int irqScanlines();
+
+            // Cartridge RAM backing a CPU address, nullptr if there is none
+            virtual uint8_t* GetStaticRAM(uint16_t addr);
+
+            // Bank registers, IRQ state and cartridge RAM to or from a save state
+            virtual void Serialize(StateStream& s);
+
+            // Bank windows, 8KB of PRG over $8000-$FFFF and 1KB of CHR over $0000-$1FFF
+            // nullptr where the mapper does not map a whole window
+            const uint8_t* pPRGWindow[4] = {};
+            const uint8_t* pCHRWindow[8] = {};
+
+            // Bumped every time a window moves or the mirroring changes
+            uint32_t nGeneration = 0;
+
+            // Set by a write to a bank or mirroring register, the windows are only rebuilt after one
+            bool bBanksDirty = false;
+
+            // Point the windows at cartridge memory for the current bank registers
+            void MapWindows(const std::vector<uint8_t>& vPRG, const std::vector<uint8_t>& vCHR);
 
         protected:
             uint8_t nPRGBanks = 0;
             uint8_t nCHRBanks = 0;
+
+        private:
+            MIRROR nWindowMirror = HARDWARE;
         };
     }
 }
\ No newline at end of file
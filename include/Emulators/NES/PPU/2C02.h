@@ -2,11 +2,10 @@
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <string>
+#include <vector>
 #include "../Cartridge/Cartridge.h"
 
-#include <Engine/Core/Renderer/PixelRender.h>
-using namespace UnifiedEngine;
-
 namespace UnifiedEmulation {
     namespace NES {
         class PPU2C02{
@@ -16,6 +15,9 @@ namespace UnifiedEmulation {
         private:
             //Vram
             uint8_t tblName[2][1024];
+            //The four nametables at $2000, $2400, $2800 and $2C00 as arranged by the mirroring
+            uint8_t* pNameTable[4] = {tblName[0], tblName[0], tblName[1], tblName[1]};
+            //Palette ram, $3F10/$3F14/$3F18/$3F1C are kept equal to the entries they mirror
             uint8_t tblPalette[32];
             uint8_t tblPattern[2][4096];
 
@@ -31,27 +33,90 @@ namespace UnifiedEmulation {
         private:
             //Cartridge
             std::shared_ptr<Cartridge> cart;
+
+            //Pattern fetches read the mapped CHR banks directly
+            const uint8_t* const* pCHRWindow = nullptr;
+            uint8_t PatternRead(uint16_t addr){
+                if(addr < 0x2000 && pCHRWindow[addr >> 10] != nullptr)
+                    return pCHRWindow[addr >> 10][addr & 0x03FF];
+                return ppuRead(addr);
+            }
+
+            //No mapper decodes the nametable range, so fetches go straight to the pages
+            uint8_t NameTableRead(uint16_t addr){
+                return pNameTable[(addr >> 10) & 0x03][addr & 0x03FF];
+            }
         public:
             //Interface
             void ConnectCartridge(const std::shared_ptr<Cartridge>& cartridge);
+            //Point the nametables at memory for the current mirroring
+            void MapNameTables();
             void clock();
             void reset();
 
+            //Memory, registers and the position in the frame, Sync first so no line is held back
+            void Serialize(StateStream& s);
+
+            //Draw visible lines in one pass when nothing touches the PPU mid line
+            bool bBatchRender = true;
+            //Bring a held back line up to the current dot, called before anything observes or changes rendering
+            void Sync();
+
+            //Earliest number of clocks before the clock that raises vertical blank
+            uint32_t DotsUntilVerticalBlank();
+            //Earliest number of clocks before the clock that makes the given mapper scanline call
+            uint32_t DotsUntilScanlineCounter(uint32_t nCount);
+            //Earliest number of clocks before the clock that finishes the frame
+            uint32_t DotsUntilFrameEnd();
+
             bool nmi = false;
 
             bool scanline_trigger = false;
         
         private:
-            vec3 palScreen[0x40];
-            PixelImage sprScreen;
-            PixelImage sprNameTable[2];
-            PixelImage sprPatternTable[2];
+            struct RGB{ uint8_t r, g, b; };
+            RGB palScreen[0x40];
+            //Packed output colour for every emphasis setting and palette value
+            uint32_t palOutput[8][0x40];
+            //Fill the emphasis tables from the base palette
+            void BuildOutputPalette();
+
+            //Palette ram entry to screen colour, grayscale and emphasis applied
+            uint32_t GetColorRGBA(uint8_t palette, uint8_t pixel){
+                return palOutput[mask.reg >> 5][tblPalette[(palette << 2) + pixel] & (mask.grayscale ? 0x30 : 0x3F)];
+            }
+
+            //Rows from the top, the core owns its pixels so it needs nothing from the renderer
+            std::vector<uint32_t> vScreen;
+            std::vector<uint32_t> vPatternTable[2];
         public:
-            PixelImage& GetScreen();
-            PixelImage& GetNameTable(uint8_t i);
-            PixelImage& GetPatternTable(uint8_t i, uint8_t palette);
+            static const int nScreenWidth = 256;
+            static const int nScreenHeight = 240;
+
+            //Same byte order as the renderer's images, red in the low byte
+            static uint32_t PackRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255){
+                return uint32_t(r) | (uint32_t(g) << 8) | (uint32_t(b) << 16) | (uint32_t(a) << 24);
+            }
+
+            //Last drawn frame, nScreenWidth x nScreenHeight packed pixels
+            const uint32_t* GetScreen() { return vScreen.data(); }
+            //128x128 view of a pattern table drawn in one of the palettes
+            const uint32_t* GetPatternTable(uint8_t i, uint8_t palette);
             bool frame_complete = false;
-            vec3 GetColorFromPaletteRam(uint8_t palette, uint8_t pixel);
+            //Frames finished since power on, unlike frame_complete nothing clears it
+            uint32_t frame_count = 0;
+            //Packed colour without emphasis
+            uint32_t GetColorFromPaletteRam(uint8_t palette, uint8_t pixel);
+
+            //Load a 64 colour or 512 colour (with emphasis) .pal file
+            bool LoadPalette(const std::string& sFileName);
+
+        private:
+            void ClockDot();
+            void RenderLine();
+            void IncrementScrollX();
+            void IncrementScrollY();
+            bool bLineDeferred = false;
 
         private:
             int16_t scanline = 0;
@@ -0,0 +1,342 @@
+#pragma once
+
+//Includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AudioRing.h"
+#include "Bus/Bus.h"
+
+namespace UnifiedEmulation
+{
+    namespace NES{
+        //Per frame history of the console for stepping back through play
+        //Each frame is kept as the xor against the last keyframe with the unchanged runs left out, packed on a thread of its own
+        class RewindBuffer{
+        public:
+            ~RewindBuffer() { Stop(); }
+
+            //Size everything for the inserted cartridge, nBytes of packed history are kept before the oldest is dropped
+            void Start(Bus& bus, size_t nBytes = 64 << 20){
+                Stop();
+
+                nStateSize = bus.GetStateSize();
+                if (nStateSize == 0)
+                    return;
+
+                vStore.assign(nBytes, 0);
+                vRecords.assign(nMaxRecords, Record{});
+                nFirst = 0;
+                nCount = 0;
+                nWrite = 0;
+                nBytesUsed = 0;
+                nSerial = 0;
+                bForceKey = true;
+                bNewestIsCurrent = false;
+
+                vSlots.assign(nSlotCount * nStateSize, 0);
+                qFree.Allocate(nSlotCount);
+                qFull.Allocate(nSlotCount);
+                for (uint32_t i = 0; i < nSlotCount; i++)
+                    qFree.Write(&i, 1);
+                nPending = 0;
+
+                vKey.assign(nStateSize, 0);
+                vDelta.assign(nStateSize, 0);
+                vPacked.assign(MaxPacked(nStateSize), 0);
+                vDecodedKey.assign(nStateSize, 0);
+                nDecodedKey = UINT64_MAX;
+                vRestore.assign(nStateSize, 0);
+
+                bActive = true;
+                Compressor = std::thread(&RewindBuffer::CompressLoop, this);
+            }
+
+            void Stop(){
+                bActive = false;
+                if (Compressor.joinable())
+                    Compressor.join();
+            }
+
+            //Snapshot the system as a frame finishes, the frame is dropped rather than waited on if the compressor is behind
+            void Push(Bus& bus){
+                //A dropped frame leaves the newest record a frame behind the system
+                uint32_t nSlot;
+                if (!bActive || qFree.Available() == 0 || bus.GetStateSize() != nStateSize){
+                    bNewestIsCurrent = false;
+                    nDropped++;
+                    return;
+                }
+
+                qFree.Read(&nSlot, 1);
+                bus.SaveState(&vSlots[nSlot * nStateSize], nStateSize);
+                nPending++;
+                qFull.Write(&nSlot, 1);
+                bNewestIsCurrent = true;
+            }
+
+            //Load the frame before the one last shown, the caller runs a frame from it to show it
+            //Once the history runs out the oldest frame is loaded again
+            bool StepBack(Bus& bus){
+                if (!bActive)
+                    return false;
+
+                //Frames still being packed are newer than anything being stepped back to
+                while (nPending > 0)
+                    std::this_thread::yield();
+
+                std::lock_guard<std::mutex> lock(muxStore);
+                if (nCount == 0)
+                    return false;
+
+                //The newest frame is where the system already is, so step over it as well
+                size_t nDrop = std::min<size_t>(bNewestIsCurrent ? 2 : 1, nCount - 1);
+                for (size_t i = 0; i < nDrop; i++){
+                    Record& r = vRecords[Index(nCount - 1)];
+                    nBytesUsed -= r.nBytes;
+                    nCount--;
+                }
+                bNewestIsCurrent = false;
+
+                //New frames start a fresh keyframe, the one they would have used may be gone
+                Record& newest = vRecords[Index(nCount - 1)];
+                nWrite = newest.nOffset + newest.nBytes;
+                bForceKey = true;
+
+                Restore(nCount - 1);
+                return bus.LoadState(vRestore.data(), nStateSize);
+            }
+
+            size_t GetFrames(){
+                std::lock_guard<std::mutex> lock(muxStore);
+                return nCount;
+            }
+
+            size_t GetBytesUsed(){
+                std::lock_guard<std::mutex> lock(muxStore);
+                return nBytesUsed;
+            }
+
+            uint64_t GetDropped() { return nDropped; }
+
+        private:
+            struct Record{
+                size_t nOffset = 0;
+                size_t nBytes = 0;
+                bool bKey = false;
+                uint64_t nSerial = 0;
+            };
+
+            //Deltas are taken against a keyframe at most this many frames old
+            static const int nKeyInterval = 60;
+            //Snapshots waiting to be packed
+            static const uint32_t nSlotCount = 8;
+            //Ten minutes of frames
+            static const size_t nMaxRecords = 60 * 60 * 10;
+
+            size_t nStateSize = 0;
+
+            //Packed frames, oldest first, laid end to end around vStore
+            std::vector<uint8_t> vStore;
+            std::vector<Record> vRecords;
+            size_t nFirst = 0;
+            size_t nCount = 0;
+            size_t nWrite = 0;
+            size_t nBytesUsed = 0;
+            uint64_t nSerial = 0;
+            bool bForceKey = true;
+            std::mutex muxStore;
+
+            //Only touched by the emulation thread
+            bool bNewestIsCurrent = false;
+            std::vector<uint8_t> vDecodedKey;
+            uint64_t nDecodedKey = UINT64_MAX;
+            std::vector<uint8_t> vRestore;
+
+            //Raw snapshots handed from the emulation thread to the compressor and back
+            std::vector<uint8_t> vSlots;
+            AudioRing<uint32_t> qFree;
+            AudioRing<uint32_t> qFull;
+            std::atomic<int> nPending{0};
+            std::atomic<uint64_t> nDropped{0};
+
+            //Only touched by the compressor
+            std::vector<uint8_t> vKey;
+            std::vector<uint8_t> vDelta;
+            std::vector<uint8_t> vPacked;
+            int nSinceKey = 0;
+
+            std::thread Compressor;
+            std::atomic<bool> bActive{false};
+
+            size_t Index(size_t n) { return (nFirst + n) % vRecords.size(); }
+
+            void CompressLoop(){
+                while (bActive){
+                    if (!qFull.WaitForData(1, std::chrono::milliseconds(50)))
+                        continue;
+
+                    uint32_t nSlot;
+                    qFull.Read(&nSlot, 1);
+                    Compress(&vSlots[nSlot * nStateSize]);
+                    qFree.Write(&nSlot, 1);
+                    nPending--;
+                }
+            }
+
+            void Compress(const uint8_t* pState){
+                bool bKey;
+                {
+                    std::lock_guard<std::mutex> lock(muxStore);
+                    bKey = bForceKey || nSinceKey >= nKeyInterval;
+                    bForceKey = false;
+                }
+
+                const uint8_t* pSource = pState;
+                if (bKey){
+                    memcpy(vKey.data(), pState, nStateSize);
+                    nSinceKey = 0;
+                }
+                else{
+                    Xor(vDelta.data(), pState, vKey.data(), nStateSize);
+                    pSource = vDelta.data();
+                }
+                nSinceKey++;
+
+                size_t nPacked = Pack(pSource, nStateSize, vPacked.data());
+
+                std::lock_guard<std::mutex> lock(muxStore);
+                Append(vPacked.data(), nPacked, bKey);
+            }
+
+            void Append(const uint8_t* pData, size_t nBytes, bool bKey){
+                if (nBytes > vStore.size())
+                    return;
+
+                if (nCount == vRecords.size())
+                    DropOldest();
+
+                size_t nStart = nWrite;
+                if (nStart + nBytes > vStore.size()){
+                    //Wrap round, everything left past the head is the oldest history
+                    while (nCount > 0 && vRecords[nFirst].nOffset >= nStart)
+                        DropOldest();
+                    nStart = 0;
+                }
+                while (nCount > 0 && vRecords[nFirst].nOffset >= nStart && vRecords[nFirst].nOffset < nStart + nBytes)
+                    DropOldest();
+
+                //The keyframe this delta was taken against has just been dropped
+                if (!bKey && nCount == 0){
+                    bForceKey = true;
+                    return;
+                }
+
+                memcpy(&vStore[nStart], pData, nBytes);
+                vRecords[Index(nCount)] = Record{ nStart, nBytes, bKey, nSerial++ };
+                nCount++;
+                nWrite = nStart + nBytes;
+                nBytesUsed += nBytes;
+            }
+
+            //Deltas can not be restored without their keyframe, so they go with it
+            void DropOldest(){
+                do{
+                    nBytesUsed -= vRecords[nFirst].nBytes;
+                    nFirst = (nFirst + 1) % vRecords.size();
+                    nCount--;
+                } while (nCount > 0 && !vRecords[nFirst].bKey);
+            }
+
+            //Rebuild the snapshot of a record into vRestore
+            void Restore(size_t n){
+                size_t nKey = n;
+                while (!vRecords[Index(nKey)].bKey)
+                    nKey--;
+
+                //Stepping back usually stays on the same keyframe for a while
+                Record& key = vRecords[Index(nKey)];
+                if (key.nSerial != nDecodedKey){
+                    Unpack(&vStore[key.nOffset], key.nBytes, vDecodedKey.data(), nStateSize);
+                    nDecodedKey = key.nSerial;
+                }
+
+                Record& r = vRecords[Index(n)];
+                if (r.bKey){
+                    memcpy(vRestore.data(), vDecodedKey.data(), nStateSize);
+                    return;
+                }
+
+                Unpack(&vStore[r.nOffset], r.nBytes, vRestore.data(), nStateSize);
+                Xor(vRestore.data(), vRestore.data(), vDecodedKey.data(), nStateSize);
+            }
+
+            static void Xor(uint8_t* pOut, const uint8_t* pA, const uint8_t* pB, size_t n){
+                size_t i = 0;
+                for (; i + 8 <= n; i += 8){
+                    uint64_t a, b;
+                    memcpy(&a, pA + i, 8);
+                    memcpy(&b, pB + i, 8);
+                    a ^= b;
+                    memcpy(pOut + i, &a, 8);
+                }
+                for (; i < n; i++)
+                    pOut[i] = pA[i] ^ pB[i];
+            }
+
+            static bool ZeroWord(const uint8_t* p){
+                uint64_t w;
+                memcpy(&w, p, 8);
+                return w == 0;
+            }
+
+            //Pairs of 16 bit lengths, zero bytes to skip then bytes to copy, each followed by the copied bytes
+            //A pair only ends on a run of at least 8 zeros, so the output is never much bigger than the input
+            static size_t MaxPacked(size_t n) { return n + 4 * (n / 8 + n / 0xFFFF + 2); }
+
+            static size_t Pack(const uint8_t* pIn, size_t n, uint8_t* pOut){
+                size_t i = 0, o = 0;
+                while (i < n){
+                    size_t nZero = i;
+                    while (nZero + 8 <= n && nZero - i + 8 <= 0xFFFF && ZeroWord(pIn + nZero))
+                        nZero += 8;
+                    while (nZero < n && nZero - i < 0xFFFF && pIn[nZero] == 0)
+                        nZero++;
+
+                    size_t nEnd = nZero;
+                    while (nEnd < n && nEnd - nZero < 0xFFFF && !(nEnd + 8 <= n && ZeroWord(pIn + nEnd)))
+                        nEnd++;
+
+                    uint16_t nSkip = (uint16_t)(nZero - i);
+                    uint16_t nCopy = (uint16_t)(nEnd - nZero);
+                    memcpy(pOut + o, &nSkip, 2);
+                    memcpy(pOut + o + 2, &nCopy, 2);
+                    memcpy(pOut + o + 4, pIn + nZero, nCopy);
+                    o += 4 + nCopy;
+                    i = nEnd;
+                }
+                return o;
+            }
+
+            static void Unpack(const uint8_t* pIn, size_t nIn, uint8_t* pOut, size_t n){
+                size_t i = 0, o = 0;
+                while (i + 4 <= nIn && o < n){
+                    uint16_t nSkip, nCopy;
+                    memcpy(&nSkip, pIn + i, 2);
+                    memcpy(&nCopy, pIn + i + 2, 2);
+                    memset(pOut + o, 0, nSkip);
+                    memcpy(pOut + o + nSkip, pIn + i + 4, nCopy);
+                    o += nSkip + nCopy;
+                    i += 4 + nCopy;
+                }
+                memset(pOut + o, 0, n - o);
+            }
+        };
+    }
+}
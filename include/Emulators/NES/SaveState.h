@@ -0,0 +1,74 @@
+#pragma once
+
+//Includes
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+namespace UnifiedEmulation
+{
+    namespace NES{
+        //Bumped whenever a device adds, drops or reorders what it serializes
+        static const uint32_t nSaveStateVersion = 1;
+
+        //Start of every snapshot, a state only loads into the build and cartridge layout that wrote it
+        struct SaveStateHeader{
+            char sMagic[4] = { 'U', 'N', 'E', 'S' };
+            uint32_t nVersion = nSaveStateVersion;
+            //Whole snapshot including this header
+            uint32_t nSize = 0;
+            uint8_t nMapperID = 0;
+            uint8_t nPRGBanks = 0;
+            uint8_t nCHRBanks = 0;
+            uint8_t nReserved = 0;
+            uint32_t nImageHash = 0;
+        };
+
+        //Moves console state to or from a flat buffer, every device runs the same Serialize both ways so the layout can not drift
+        //Without a buffer it only counts, which is how the size of a snapshot is found
+        class StateStream{
+        public:
+            //Counting
+            StateStream() {}
+            //Saving, nothing is written past nSize
+            StateStream(uint8_t* pBuffer, size_t nSize) : pWrite(pBuffer), nSize(nSize) {}
+            //Loading
+            StateStream(const uint8_t* pBuffer, size_t nSize) : pRead(pBuffer), nSize(nSize), bLoading(true) {}
+
+            bool IsLoading() { return bLoading; }
+            //Ran past the end of the buffer, the snapshot is incomplete
+            bool Overflowed() { return bOverflow; }
+            size_t GetSize() { return nPosition; }
+
+            void Bytes(void* pData, size_t nBytes){
+                bool bCounting = pWrite == nullptr && pRead == nullptr;
+                if (!bCounting && (bOverflow || nPosition + nBytes > nSize)){
+                    bOverflow = true;
+                    return;
+                }
+
+                if (bLoading)
+                    memcpy(pData, pRead + nPosition, nBytes);
+                else if (pWrite)
+                    memcpy(pWrite + nPosition, pData, nBytes);
+                nPosition += nBytes;
+            }
+
+            //Plain data goes in exactly as it sits in memory
+            template<typename T>
+            void Field(T& value){
+                static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be copied into a save state");
+                Bytes(&value, sizeof(T));
+            }
+
+        private:
+            uint8_t* pWrite = nullptr;
+            const uint8_t* pRead = nullptr;
+            size_t nSize = 0;
+            size_t nPosition = 0;
+            bool bLoading = false;
+            bool bOverflow = false;
+        };
+    }
+}
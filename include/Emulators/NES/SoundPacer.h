@@ -6,6 +6,7 @@
 #include <istream>
 #include <cstring>
 #include <climits>
+#include <cmath>
 #include <condition_variable>
 #include <algorithm>
 #include <queue>
@@ -13,6 +14,12 @@
 #include <functional>
 #include <atomic>
 #include <list>
+#include <chrono>
+
+#include <memory>
+
+#include "AudioRing.h"
+#include "AudioSink.h"
 #undef min
 #undef max
 
@@ -31,8 +38,11 @@ namespace UnifiedEmulation
         } OLC_WAVEFORMATEX;
         #pragma pack(pop)
 
+        //Every instance owns its ring, sink and device thread, so any number of systems can each have their own
         class EmulationSound{
         public:
+            ~EmulationSound() { DestroyAudio(); }
+
             class AudioSample
             {
             public:
@@ -55,53 +65,97 @@ namespace UnifiedEmulation
                 bool bFlagForStop = false;
             };
 
-            static std::list<sCurrentlyPlayingSample> listActiveSamples;
+            std::list<sCurrentlyPlayingSample> listActiveSamples;
+            //All loaded sound samples, ids count from 1
+            std::vector<AudioSample> vecAudioSamples;
+
+        public:
+            //Block callbacks get nFrames frames of nChannels interleaved samples
+            typedef std::function<void(float* pOut, size_t nFrames, int nChannels)> BlockFunction;
 
         public:
-            static bool InitialiseAudio(unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 8, unsigned int nBlockSamples = 512);
-            static bool DestroyAudio();
-            static void SetUserSynthFunction(std::function<float(int, float, float)> func);
-            static void SetUserFilterFunction(std::function<float(int, float, float)> func);
+            //Latency starts at two small blocks and grows when the device runs dry, nBlocks and nBlockSamples are the most it may grow to
+            bool InitialiseAudio(unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 16, unsigned int nBlockSamples = 2048);
+            //Output to a sink instead of a device, nothing drains the ring until Pump is called
+            bool InitialiseSink(std::unique_ptr<AudioSink> pSink, unsigned int nSampleRate = 48000, unsigned int nChannels = 1);
+            bool DestroyAudio();
+
+            //A device thread drains the ring, otherwise whoever fills it has to Pump
+            bool IsDeviceDriven() { return m_pSink == nullptr; }
+            //Mix everything waiting in the ring and hand it to the sink
+            void Pump();
+            //The synth renders a whole block into a cleared buffer, the filter works on the mixed block in place
+            void SetUserSynthFunction(BlockFunction func);
+            void SetUserFilterFunction(BlockFunction func);
 
         public:
             //static int LoadAudioSample(std::string sWavFile, olc::ResourcePack *pack = nullptr);
-            static void PlaySample(int id, bool bLoop = false);
-            static void StopSample(int id);
-            static void StopAll();
-            static float GetMixerOutput(int nChannel, float fGlobalTime, float fTimeStep);
+            void PlaySample(int id, bool bLoop = false);
+            void StopSample(int id);
+            void StopAll();
+            //Add the playing samples over a block, finished ones are dropped once per block
+            void MixActiveSamples(float* pOut, size_t nFrames);
+            //Samples, user synth and user filter over a block of ring output, pScratch holds a block for the synth
+            void MixBlock(float* pBlock, float* pScratch, size_t nFrames);
 
         public:
-            static std::queue<ALuint> m_qAvailableBuffers;
-            static ALuint *m_pBuffers;
-            static ALuint m_nSource;
-            static ALCdevice *m_pDevice;
-            static ALCcontext *m_pContext;
-            static unsigned int m_nSampleRate;
-            static unsigned int m_nChannels;
-            static unsigned int m_nBlockCount;
-            static unsigned int m_nBlockSamples;
-            static short* m_pBlockMemory;
-
-            static void AudioThread();
-            static std::thread m_AudioThread;
-            static std::atomic<bool> m_bAudioThreadActive;
-            static std::atomic<float> m_fGlobalTime;
-            static std::function<float(int, float, float)> funcUserSynth;
-            static std::function<float(int, float, float)> funcUserFilter;
+            //Emulation writes its samples here in blocks, the audio thread drains it into OpenAL
+            AudioRing<float> m_Ring;
+            //Samples the producer keeps queued in the ring ahead of the audio thread
+            //It writes a video frame at a time, so about a frame of samples plus the block being waited on
+            size_t GetRingTarget() { return m_nSampleRate / 60 * m_nChannels + m_nBlockSamples; }
+
+            uint64_t GetUnderruns() { return m_Ring.GetUnderruns(); }
+            uint64_t GetOverruns() { return m_Ring.GetOverruns(); }
+
+            //Times the device played out everything it had queued
+            uint64_t GetDeviceUnderruns() { return m_nDeviceUnderruns; }
+            //Blocks queued on the device and the number the audio thread is aiming for
+            unsigned int GetQueueDepth() { return m_nQueuedBlocks; }
+            unsigned int GetQueueTarget() { return m_nQueueTarget; }
+            unsigned int GetBlockSamples() { return m_nBlockSamples; }
+            //Time a sample written to the ring now takes to reach the device output
+            float GetLatencyMs() { return m_fLatencyMs; }
+
+        public:
+            std::queue<ALuint> m_qAvailableBuffers;
+            ALuint *m_pBuffers = nullptr;
+            ALuint m_nSource = 0;
+            ALCdevice *m_pDevice = nullptr;
+            ALCcontext *m_pContext = nullptr;
+            unsigned int m_nSampleRate = 0;
+            unsigned int m_nChannels = 0;
+            unsigned int m_nBlockCount = 0;
+            std::atomic<unsigned int> m_nBlockSamples{ 0 };
+            unsigned int m_nMaxBlockSamples = 0;
+            short* m_pBlockMemory = nullptr;
+
+            std::atomic<unsigned int> m_nQueueTarget{ 0 };
+            std::atomic<unsigned int> m_nQueuedBlocks{ 0 };
+            std::atomic<uint64_t> m_nDeviceUnderruns{ 0 };
+            std::atomic<float> m_fLatencyMs{ 0.0f };
+
+            void AudioThread();
+            std::thread m_AudioThread;
+            std::atomic<bool> m_bAudioThreadActive{ false };
+            std::atomic<float> m_fGlobalTime{ 0.0f };
+            BlockFunction funcUserSynth = nullptr;
+            BlockFunction funcUserFilter = nullptr;
+
+            std::unique_ptr<AudioSink> m_pSink;
+            std::vector<float> m_vPumpBlock;
+            std::vector<float> m_vPumpScratch;
         };
 
         EmulationSound::AudioSample::AudioSample()
         {	}
 
-        // This vector holds all loaded sound samples in memory
-        std::vector<EmulationSound::AudioSample> vecAudioSamples;
-
-        void EmulationSound::SetUserSynthFunction(std::function<float(int, float, float)> func)
+        void EmulationSound::SetUserSynthFunction(BlockFunction func)
         {
             funcUserSynth = func;
         }
 
-        void EmulationSound::SetUserFilterFunction(std::function<float(int, float, float)> func)
+        void EmulationSound::SetUserFilterFunction(BlockFunction func)
         {
             funcUserFilter = func;
         }
@@ -115,7 +169,7 @@ namespace UnifiedEmulation
             a.bFinished = false;
             a.bFlagForStop = false;
             a.bLoop = bLoop;
-            EmulationSound::listActiveSamples.push_back(a);
+            listActiveSamples.push_back(a);
         }
 
         void EmulationSound::StopSample(int id)
@@ -134,64 +188,59 @@ namespace UnifiedEmulation
             }
         }
 
-        float EmulationSound::GetMixerOutput(int nChannel, float fGlobalTime, float fTimeStep)
+        void EmulationSound::MixActiveSamples(float* pOut, size_t nFrames)
         {
-            // Accumulate sample for this channel
-            float fMixerSample = 0.0f;
-
             for (auto &s : listActiveSamples)
             {
-                if (m_bAudioThreadActive)
+                if (s.bFlagForStop)
+                {
+                    s.bLoop = false;
+                    s.bFinished = true;
+                    continue;
+                }
+
+                const AudioSample &wav = vecAudioSamples[s.nAudioSampleID - 1];
+
+                // Source samples stepped per output frame
+                long nStep = std::max(1L, lroundf((float)wav.wavHeader.nSamplesPerSec / (float)m_nSampleRate));
+                unsigned int nSourceChannels = std::min((unsigned int)wav.nChannels, m_nChannels);
+
+                size_t f = 0;
+                while (f < nFrames && !s.bFinished)
                 {
-                    if (s.bFlagForStop)
+                    // Frames that can be taken before running off the end of the sample
+                    long nLeft = std::max(0L, (wav.nSamples - 1 - s.nSamplePosition) / nStep);
+                    size_t nRun = std::min(nFrames - f, (size_t)nLeft);
+
+                    for (unsigned int c = 0; c < nSourceChannels; c++)
                     {
-                        s.bLoop = false;
-                        s.bFinished = true;
+                        const float *pSource = wav.fSample + (s.nSamplePosition + nStep) * wav.nChannels + c;
+                        float *pDest = pOut + f * m_nChannels + c;
+                        for (size_t i = 0; i < nRun; i++)
+                            pDest[i * m_nChannels] += pSource[i * nStep * wav.nChannels];
                     }
-                    else
-                    {
-                        // Calculate sample position
-                        s.nSamplePosition += roundf((float)vecAudioSamples[s.nAudioSampleID - 1].wavHeader.nSamplesPerSec * fTimeStep);
 
-                        // If sample position is valid add to the mix
-                        if (s.nSamplePosition < vecAudioSamples[s.nAudioSampleID - 1].nSamples)
-                            fMixerSample += vecAudioSamples[s.nAudioSampleID - 1].fSample[(s.nSamplePosition * vecAudioSamples[s.nAudioSampleID - 1].nChannels) + nChannel];
-                        else
+                    s.nSamplePosition += nRun * nStep;
+                    f += nRun;
+
+                    // The frame that steps past the end is silent, then the sample loops or completes
+                    if (f < nFrames)
+                    {
+                        if (s.bLoop)
                         {
-                            if (s.bLoop)
-                            {
-                                s.nSamplePosition = 0;
-                            }
-                            else
-                                s.bFinished = true; // Else sound has completed
+                            s.nSamplePosition = 0;
+                            f++;
                         }
+                        else
+                            s.bFinished = true;
                     }
                 }
-                else
-                    return 0.0f;
             }
 
             // If sounds have completed then remove them
             listActiveSamples.remove_if([](const sCurrentlyPlayingSample &s) {return s.bFinished; });
-
-            // The users application might be generating sound, so grab that if it exists
-            if (funcUserSynth != nullptr)
-                fMixerSample += funcUserSynth(nChannel, fGlobalTime, fTimeStep);
-
-            // Return the sample via an optional user override to filter the sound
-            if (funcUserFilter != nullptr)
-                return funcUserFilter(nChannel, fGlobalTime, fMixerSample);
-            else
-                return fMixerSample;
         }
 
-        std::thread EmulationSound::m_AudioThread;
-        std::atomic<bool> EmulationSound::m_bAudioThreadActive{ false };
-        std::atomic<float> EmulationSound::m_fGlobalTime{ 0.0f };
-        std::list<EmulationSound::sCurrentlyPlayingSample> EmulationSound::listActiveSamples;
-        std::function<float(int, float, float)> EmulationSound::funcUserSynth = nullptr;
-        std::function<float(int, float, float)> EmulationSound::funcUserFilter = nullptr;
-
         bool EmulationSound::InitialiseAudio(unsigned int nSampleRate, unsigned int nChannels, unsigned int nBlocks, unsigned int nBlockSamples)
         {
             // Initialise Sound Engine
@@ -199,19 +248,36 @@ namespace UnifiedEmulation
             m_nSampleRate = nSampleRate;
             m_nChannels = nChannels;
             m_nBlockCount = nBlocks;
-            m_nBlockSamples = nBlockSamples;
+            m_nMaxBlockSamples = nBlockSamples;
             m_pBlockMemory = nullptr;
 
+            // Start at the lowest latency and let the audio thread find what the machine can keep up with
+            m_nBlockSamples = std::min(256 * nChannels, nBlockSamples);
+            m_nQueueTarget = std::min(2u, nBlocks);
+            m_nQueuedBlocks = 0;
+            m_nDeviceUnderruns = 0;
+            m_fLatencyMs = 0.0f;
+
             // Open the device and create the context
             m_pDevice = alcOpenDevice(NULL);
             if (m_pDevice)
             {
-                m_pContext = alcCreateContext(m_pDevice, NULL);
+                // Ask for the rate we want, then use the one the device actually mixes at so OpenAL does not resample again
+                ALCint nAttributes[] = { ALC_FREQUENCY, (ALCint)m_nSampleRate, 0 };
+                m_pContext = alcCreateContext(m_pDevice, nAttributes);
                 alcMakeContextCurrent(m_pContext);
+
+                ALCint nDeviceRate = 0;
+                alcGetIntegerv(m_pDevice, ALC_FREQUENCY, 1, &nDeviceRate);
+                if (nDeviceRate > 0)
+                    m_nSampleRate = (unsigned int)nDeviceRate;
             }
             else
                 return DestroyAudio();
 
+            //Room for a few frames on top of the largest block
+            m_Ring.Allocate(m_nSampleRate / 15 * m_nChannels + 2 * m_nMaxBlockSamples);
+
             // Allocate memory for sound data
             alGetError();
             m_pBuffers = new ALuint[m_nBlockCount];
@@ -224,44 +290,139 @@ namespace UnifiedEmulation
             listActiveSamples.clear();
 
             // Allocate Wave|Block Memory
-            m_pBlockMemory = new short[m_nBlockSamples];
+            m_pBlockMemory = new short[m_nMaxBlockSamples];
             if (m_pBlockMemory == nullptr)
                 return DestroyAudio();
-            std::fill(m_pBlockMemory, m_pBlockMemory + m_nBlockSamples, 0);
+            std::fill(m_pBlockMemory, m_pBlockMemory + m_nMaxBlockSamples, 0);
 
             m_bAudioThreadActive = true;
-            m_AudioThread = std::thread(&EmulationSound::AudioThread);
+            m_AudioThread = std::thread(&EmulationSound::AudioThread, this);
+            return true;
+        }
+
+        bool EmulationSound::InitialiseSink(std::unique_ptr<AudioSink> pSink, unsigned int nSampleRate, unsigned int nChannels)
+        {
+            m_nSampleRate = nSampleRate;
+            m_nChannels = nChannels;
+            m_nBlockCount = 1;
+            m_nBlockSamples = 1024 * nChannels;
+            m_nMaxBlockSamples = m_nBlockSamples;
+            listActiveSamples.clear();
+
+            //Enough for several frames between pumps at any rate
+            m_Ring.Allocate(1 << 15);
+            m_vPumpBlock.assign(m_nBlockSamples, 0.0f);
+            m_vPumpScratch.assign(m_nBlockSamples, 0.0f);
+
+            if (pSink == nullptr || !pSink->Open(m_nSampleRate, m_nChannels))
+                return false;
+
+            m_pSink = std::move(pSink);
             return true;
         }
 
+        void EmulationSound::Pump()
+        {
+            if (m_pSink == nullptr)
+                return;
+
+            size_t nBlockFrames = m_vPumpBlock.size() / m_nChannels;
+            size_t nFrames;
+            while ((nFrames = std::min(m_Ring.Available() / m_nChannels, nBlockFrames)) > 0)
+            {
+                m_Ring.Read(m_vPumpBlock.data(), nFrames * m_nChannels);
+                MixBlock(m_vPumpBlock.data(), m_vPumpScratch.data(), nFrames);
+                m_pSink->Write(m_vPumpBlock.data(), nFrames);
+            }
+        }
+
+        void EmulationSound::MixBlock(float* pBlock, float* pScratch, size_t nFrames)
+        {
+            size_t nSamples = nFrames * m_nChannels;
+
+            MixActiveSamples(pBlock, nFrames);
+
+            if (funcUserSynth != nullptr)
+            {
+                std::fill(pScratch, pScratch + nSamples, 0.0f);
+                funcUserSynth(pScratch, nFrames, m_nChannels);
+                for (size_t n = 0; n < nSamples; n++)
+                    pBlock[n] += pScratch[n];
+            }
+
+            if (funcUserFilter != nullptr)
+                funcUserFilter(pBlock, nFrames, m_nChannels);
+
+            m_fGlobalTime = m_fGlobalTime + nFrames / (float)m_nSampleRate;
+        }
+
         // Stop and clean up audio system
         bool EmulationSound::DestroyAudio()
         {
+            // Sinks get whatever is still waiting before they close
+            if (m_pSink != nullptr)
+            {
+                Pump();
+                m_pSink->Close();
+                m_pSink.reset();
+                return false;
+            }
+
             m_bAudioThreadActive = false;
             if(m_AudioThread.joinable())
                 m_AudioThread.join();
 
+            if (m_pDevice == nullptr)
+                return false;
+
             alDeleteBuffers(m_nBlockCount, m_pBuffers);
             delete[] m_pBuffers;
+            m_pBuffers = nullptr;
+            delete[] m_pBlockMemory;
+            m_pBlockMemory = nullptr;
             alDeleteSources(1, &m_nSource);
 
             alcMakeContextCurrent(NULL);
             alcDestroyContext(m_pContext);
             alcCloseDevice(m_pDevice);
+            m_pContext = nullptr;
+            m_pDevice = nullptr;
             return false;
         }
 
         void EmulationSound::AudioThread()
         {
             m_fGlobalTime = 0.0f;
-            static float fTimeStep = 1.0f / (float)m_nSampleRate;
 
             // Goofy hack to get maximum integer for a type at run-time
             short nMaxSample = (short)pow(2, (sizeof(short) * 8) - 1) - 1;
             float fMaxSample = (float)nMaxSample;
-            short nPreviousSample = 0;
 
             std::vector<ALuint> vProcessed;
+            std::vector<float> vBlock(m_nMaxBlockSamples);
+            std::vector<float> vSynth(m_nMaxBlockSamples);
+
+            //Time it takes OpenAL to play a block of the current size
+            auto BlockTime = [this](unsigned int nSamples) { return std::chrono::microseconds(1000000ull * nSamples / (m_nChannels * m_nSampleRate)); };
+
+            //Deeper queue first, then bigger blocks, a new latency gets a moment to fill before it can grow again
+            auto tLastGrow = std::chrono::steady_clock::now();
+            auto GrowLatency = [&]()
+            {
+                auto tNow = std::chrono::steady_clock::now();
+                if (tNow - tLastGrow < std::chrono::milliseconds(250))
+                    return;
+                tLastGrow = tNow;
+
+                if (m_nQueueTarget < std::min(4u, m_nBlockCount))
+                    m_nQueueTarget++;
+                else if (m_nBlockSamples * 2 <= m_nMaxBlockSamples)
+                    m_nBlockSamples = m_nBlockSamples * 2;
+                else if (m_nQueueTarget < m_nBlockCount)
+                    m_nQueueTarget++;
+            };
+
+            bool bPlaying = false;
 
             while (m_bAudioThreadActive)
             {
@@ -274,38 +435,50 @@ namespace UnifiedEmulation
                 alSourceUnqueueBuffers(m_nSource, nProcessed, vProcessed.data());
                 for (ALint nBuf : vProcessed) m_qAvailableBuffers.push(nBuf);
 
-                // Wait until there is a free buffer (ewww)
-                if (m_qAvailableBuffers.empty()) continue;
-
-                short nNewSample = 0;
+                unsigned int nBlockSamples = m_nBlockSamples;
+                unsigned int nQueued = m_nBlockCount - (unsigned int)m_qAvailableBuffers.size();
+                m_nQueuedBlocks = nQueued;
+                m_fLatencyMs = (float)(nQueued * nBlockSamples + m_Ring.Available()) * 1000.0f / (float)(m_nChannels * m_nSampleRate);
 
-                auto clip = [](float fSample, float fMax)
+                // The source stops by itself once it has played everything queued
+                if (bPlaying && nState != AL_PLAYING)
                 {
-                    if (fSample >= 0.0)
-                        return fmin(fSample, fMax);
-                    else
-                        return fmax(fSample, -fMax);
-                };
-
-                for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
-                {
-                    // User Process
-                    for (unsigned int c = 0; c < m_nChannels; c++)
-                    {
-                        nNewSample = (short)(clip(GetMixerOutput(c, m_fGlobalTime, fTimeStep), 1.0) * fMaxSample);
-                        m_pBlockMemory[n + c] = nNewSample;
-                        nPreviousSample = nNewSample;
-                    }
+                    m_nDeviceUnderruns++;
+                    bPlaying = false;
+                    GrowLatency();
+                }
 
-                    m_fGlobalTime = m_fGlobalTime + fTimeStep;
+                // Sleep until OpenAL has played part of a block
+                if (nQueued >= m_nQueueTarget || m_qAvailableBuffers.empty()){
+                    std::this_thread::sleep_for(BlockTime(nBlockSamples) / 4);
+                    continue;
                 }
 
+                // Wait for the emulation to produce a block, only give up on it once OpenAL is about to run dry
+                bool bQueueLow = nQueued <= 1;
+                if (!m_Ring.WaitForData(nBlockSamples, BlockTime(nBlockSamples)) && !bQueueLow)
+                    continue;
+
+                size_t nRead = m_Ring.Read(vBlock.data(), nBlockSamples);
+                std::fill(vBlock.begin() + nRead, vBlock.begin() + nBlockSamples, 0.0f);
+
+                // Padding with silence is as audible as the device stopping
+                if (nRead < nBlockSamples && bPlaying)
+                    GrowLatency();
+
+                // Everything else is mixed a block at a time
+                MixBlock(vBlock.data(), vSynth.data(), nBlockSamples / m_nChannels);
+
+                // Clip and convert in one straight pass
+                for (unsigned int n = 0; n < nBlockSamples; n++)
+                    m_pBlockMemory[n] = (short)(std::min(std::max(vBlock[n], -1.0f), 1.0f) * fMaxSample);
+
                 // Fill OpenAL data buffer
                 alBufferData(
                     m_qAvailableBuffers.front(),
                     m_nChannels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16,
                     m_pBlockMemory,
-                    2 * m_nBlockSamples,
+                    2 * nBlockSamples,
                     m_nSampleRate
                 );
                 // Add it to the OpenAL queue
@@ -315,19 +488,11 @@ namespace UnifiedEmulation
 
                 // If it's not playing for some reason, change that
                 if (nState != AL_PLAYING)
+                {
                     alSourcePlay(m_nSource);
+                    bPlaying = true;
+                }
             }
         }
-
-        std::queue<ALuint> EmulationSound::m_qAvailableBuffers;
-        ALuint *EmulationSound::m_pBuffers = nullptr;
-        ALuint EmulationSound::m_nSource = 0;
-        ALCdevice *EmulationSound::m_pDevice = nullptr;
-        ALCcontext *EmulationSound::m_pContext = nullptr;
-        unsigned int EmulationSound::m_nSampleRate = 0;
-        unsigned int EmulationSound::m_nChannels = 0;
-        unsigned int EmulationSound::m_nBlockCount = 0;
-        unsigned int EmulationSound::m_nBlockSamples = 0;
-        short* EmulationSound::m_pBlockMemory = nullptr;
     }
 }
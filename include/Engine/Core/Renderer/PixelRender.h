@@ -15,66 +15,57 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
 
 using namespace std;
 using namespace glm;
 
 namespace UnifiedEngine {
-    //Pixel
-    struct Pixel{
-        vec4 Color;
-        ivec2 Position;
-    };
-
     class PixelImage{
     private:
-        //Image
-        vector<vector<Pixel>>Image;
-        //Data
-        unsigned char* RawData;
+        //Image, one contiguous RGBA8 buffer stored bottom row first for OpenGL
+        uint32_t* Data = nullptr;
+
+        //Buffer rows start on cache lines so whole rows can be copied or uploaded in one go
+        static constexpr size_t Alignment = 64;
 
-        bool First;
+        //Allocate Buffer For Size
+        void Allocate(){
+            size_t Bytes = (size_t(this->Size.x) * this->Size.y * sizeof(uint32_t) + Alignment - 1) & ~(Alignment - 1);
+            this->Data = static_cast<uint32_t*>(::operator new[](Bytes, std::align_val_t(Alignment)));
+        }
 
         //Delete Old
         void DeleteData(){
-            delete this->RawData;
+            if(this->Data)
+                ::operator delete[](this->Data, std::align_val_t(Alignment));
+            this->Data = nullptr;
         }
 
-        //Generate From Image
-        void GenData(){
-            //Sizes
-            const int SizeX = this->Size.x;
-            const int SizeY = this->Size.y;
-            
-            //Delete Old
-            if(!this->First)
-                this->DeleteData();
-
-            //Prealocate
-            this->RawData = new unsigned char[SizeX * SizeY *3];
-
-            //Write Color
-            for(int y = 0; y < this->Size.y; y++){
-                for(int x = 0; x < this->Size.x; x++){
-                    //Calc Colors
-                    int RI = roundf(this->Image[y][x].Color.x * 255);
-                    int GI = roundf(this->Image[y][x].Color.y * 255);
-                    int BI = roundf(this->Image[y][x].Color.z * 255);
-                    //Write Colors
-                    this->RawData[y * SizeX * 3 + x * 3] = RI;
-                    this->RawData[y * SizeX * 3 + x * 3 + 1] = GI;
-                    this->RawData[y * SizeX * 3 + x * 3 + 2] = BI;
-                }
-            }
+        //Fill With Color
+        void Fill(vec3 color){
+            std::fill(this->Data, this->Data + this->Size.x * this->Size.y, PackRGBA(vec4(color, 1)));
         }
+
     public:
         //Sizeing
         ivec2 Size;
+
+        //Pack 8 bit channels in memory order R, G, B, A
+        static uint32_t PackRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255){
+            return uint32_t(r) | (uint32_t(g) << 8) | (uint32_t(b) << 16) | (uint32_t(a) << 24);
+        }
+
+        //Pack a 0-1 colour
+        static uint32_t PackRGBA(vec4 col){
+            auto Channel = [](float c) -> uint8_t { return roundf(std::min(std::max(c, 0.0f), 1.0f) * 255); };
+            return PackRGBA(Channel(col.x), Channel(col.y), Channel(col.z), Channel(col.w));
+        }
         
         //Initialise Defualts
         PixelImage(ivec2 Size, vec3 color = vec3(0)){
-            this->First = true;
-            
             //Size
             this->Size = Size;
             if (this->Size.x < 1){
@@ -85,18 +76,26 @@ namespace UnifiedEngine {
             }  
 
             //Solid Color
-            for(int y = 0; y < this->Size.y; y++){
-                this->Image.push_back(vector<Pixel>{});
-                for(int x = 0; x < this->Size.x; x++){
-                    this->Image[y].push_back(Pixel{vec4(color, 1), ivec2(x, y)});
-                    //this->Image[y].push_back(Pixel{vec3(static_cast<float>(x)/this->Size.x, static_cast<float>(y)/this->Size.y, (static_cast<float>(x)+static_cast<float>(y))/(this->Size.x+this->Size.y)),ivec2(x,y)});
-                }
-            }
+            this->Allocate();
+            this->Fill(color);
+        }
 
-            //Generate
-            this->GenData();
+        PixelImage(const PixelImage& Other){
+            this->Size = Other.Size;
+            this->Allocate();
+            std::copy(Other.Data, Other.Data + this->Size.x * this->Size.y, this->Data);
+        }
 
-            this->First = false;
+        PixelImage& operator=(const PixelImage& Other){
+            if(this != &Other){
+                if(this->Size != Other.Size){
+                    this->DeleteData();
+                    this->Size = Other.Size;
+                    this->Allocate();
+                }
+                std::copy(Other.Data, Other.Data + this->Size.x * this->Size.y, this->Data);
+            }
+            return *this;
         }
 
         //Delete Old
@@ -106,51 +105,68 @@ namespace UnifiedEngine {
         
         //Recolor
         void Configure(ivec2 Size, vec3 color = vec3(0)){
-
-            //Size
-            this->Size = Size;
-            if (this->Size.x < 1){
-                this->Size.x = 1;
+            if (Size.x < 1){
+                Size.x = 1;
             }
-            if (this->Size.y < 1){
-                this->Size.y = 1;
+            if (Size.y < 1){
+                Size.y = 1;
             }
 
-            //Delete Image
-            this->Image.clear();
+            //Only reallocate on a size change
+            if(Size != this->Size){
+                this->DeleteData();
+                this->Size = Size;
+                this->Allocate();
+            }
+
+            this->Fill(color);
+        }
+
+        //Row of pixels counted from the top, as SetPixel positions are
+        uint32_t* Row(int y){
+            return this->Data + ((this->Size.y - 1) - y) * this->Size.x;
+        }
 
-            //Loop Over Image
+        //Copy in a whole image of packed pixels stored a row at a time from the top
+        void CopyRGBA(const uint32_t* pPixels){
             for(int y = 0; y < this->Size.y; y++){
-                this->Image.push_back(vector<Pixel>{});
-                for(int x = 0; x < this->Size.x; x++){
-                    this->Image[y].push_back(Pixel{vec4(color, 1), ivec2(x, y)});
-                    //this->Image[y].push_back(Pixel{vec3(static_cast<float>(x)/this->Size.x, static_cast<float>(y)/this->Size.y, (static_cast<float>(x)+static_cast<float>(y))/(this->Size.x+this->Size.y)),ivec2(x,y)});
-                }
+                memcpy(this->Row(y), pPixels + y * this->Size.x, this->Size.x * sizeof(uint32_t));
             }
         }
 
-        //Set Specific Pixel
-        void SetPixel(ivec2 Pos, vec3 col){
+        //Set Specific Pixel From A Packed Colour
+        void SetPixelRGBA(ivec2 Pos, uint32_t col){
             if(Pos.y > -1 && Pos.x > -1){
                 if(Pos.y < this->Size.y && Pos.x < this->Size.x){
-                    this->Image[(this->Size.y - 1) - Pos.y][Pos.x].Color = vec4(col.x/255, col.y/255, col.z/255, 1);
+                    this->Row(Pos.y)[Pos.x] = col;
                 }
             }
         }
 
+        //Set Specific Pixel
+        void SetPixel(ivec2 Pos, vec3 col){
+            this->SetPixelRGBA(Pos, PackRGBA(roundf(col.x), roundf(col.y), roundf(col.z)));
+        }
+
         //Sel Pixel With Alpha
         void SetPixel(ivec2 Pos, vec4 col){
+            this->SetPixelRGBA(Pos, PackRGBA(col));
+        }
+
+        //Get Specific Pixel
+        vec4 GetPixel(ivec2 Pos){
             if(Pos.y > -1 && Pos.x > -1){
                 if(Pos.y < this->Size.y && Pos.x < this->Size.x){
-                    this->Image[(this->Size.y - 1) - Pos.y][Pos.x].Color = col;
+                    uint32_t col = this->Row(Pos.y)[Pos.x];
+                    return vec4((col & 0xFF) / 255.0f, ((col >> 8) & 0xFF) / 255.0f, ((col >> 16) & 0xFF) / 255.0f, (col >> 24) / 255.0f);
                 }
             }
+            return vec4(0);
         }
 
-        //Return Generated Data
+        //Return Data, RGBA8 ready for upload
         unsigned char* ReturnData(){
-            this->GenData();
-            return this->RawData;
+            return reinterpret_cast<unsigned char*>(this->Data);
         }
     };
 }
\ No newline at end of file
@@ -7,13 +7,15 @@
 
 #include <SOIL2/SOIL2.h>
 
+#include <cstring>
+
 namespace UnifiedEngine {
 	int __NextAvailableTextureUnit = 1;
 
 	class Texture2D {
 	private:
 		//Texture Reference to buffer
-		GLuint id;
+		GLuint id = 0;
 
 		//Image size
 		int width;
@@ -21,6 +23,75 @@ namespace UnifiedEngine {
 
 		//Unit to store texture when rendering
 		GLint Unit;
+
+		//Raw data textures keep their storage and stream new frames through mapped pixel buffers
+		static const int StreamBufferCount = 3;
+		bool bStreaming = false;
+		GLuint StreamBuffers[StreamBufferCount] = {};
+		unsigned char* StreamMapped[StreamBufferCount] = {};
+		GLsync StreamFences[StreamBufferCount] = {};
+		int nStreamBuffer = 0;
+
+		//Create the persistently mapped upload buffers for the current size
+		void CreateStreamBuffers() {
+			GLsizeiptr Bytes = GLsizeiptr(this->width) * this->height * 4;
+			GLbitfield Flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+			glGenBuffers(StreamBufferCount, this->StreamBuffers);
+			for (int i = 0; i < StreamBufferCount; i++) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->StreamBuffers[i]);
+				glBufferStorage(GL_PIXEL_UNPACK_BUFFER, Bytes, nullptr, Flags);
+				this->StreamMapped[i] = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, Bytes, Flags);
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			this->nStreamBuffer = 0;
+			this->bStreaming = true;
+		}
+
+		//Unmap and free the upload buffers
+		void DeleteStreamBuffers() {
+			if (!this->bStreaming)
+				return;
+
+			for (int i = 0; i < StreamBufferCount; i++) {
+				if (this->StreamFences[i]) {
+					glDeleteSync(this->StreamFences[i]);
+					this->StreamFences[i] = 0;
+				}
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->StreamBuffers[i]);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				this->StreamMapped[i] = nullptr;
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glDeleteBuffers(StreamBufferCount, this->StreamBuffers);
+
+			this->bStreaming = false;
+		}
+
+		//Copy a frame into the next free buffer and upload it into the existing storage
+		void StreamTexture(unsigned char* Data) {
+			int i = this->nStreamBuffer;
+			this->nStreamBuffer = (this->nStreamBuffer + 1) % StreamBufferCount;
+
+			//Wait for the upload that last used this buffer, normally long finished
+			if (this->StreamFences[i]) {
+				glClientWaitSync(this->StreamFences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+				glDeleteSync(this->StreamFences[i]);
+				this->StreamFences[i] = 0;
+			}
+
+			memcpy(this->StreamMapped[i], Data, size_t(this->width) * this->height * 4);
+
+			glBindTexture(GL_TEXTURE_2D, this->id);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->StreamBuffers[i]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			this->StreamFences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+			//Free Binding
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
 	public:
 		//Init from a file
 		Texture2D(const char* fileLoc){
@@ -81,13 +152,16 @@ namespace UnifiedEngine {
 
 			//If data exists write it
 			if (Data) {
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, this->width, this->height, 0, GL_RGB, GL_UNSIGNED_BYTE, Data);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, this->width, this->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, Data);
 				glGenerateMipmap(GL_TEXTURE_2D);
 			}
 
 			//Free Texturs
 			glActiveTexture(0);
 			glBindTexture(GL_TEXTURE_2D, 0);
+
+			//Later frames stream into the same storage
+			this->CreateStreamBuffers();
 		}
 
 		//No Loading
@@ -95,6 +169,7 @@ namespace UnifiedEngine {
 
 		//Deleting
 		~Texture2D() {
+			this->DeleteStreamBuffers();
 			if(this->id)
 				glDeleteTextures(1, &this->id);
 		}
@@ -152,7 +227,14 @@ namespace UnifiedEngine {
 
 		//Update File With Raw Data
 		void UpdateTexture(unsigned char* Data, int imgWidth, int imgHeight) {
+			//Same size frames only replace the pixels
+			if (this->id && this->bStreaming && Data && imgWidth == this->width && imgHeight == this->height) {
+				this->StreamTexture(Data);
+				return;
+			}
+
 			//Remove old
+			this->DeleteStreamBuffers();
 			if (this->id) {
 				glDeleteTextures(1, &this->id);
 			}
@@ -174,13 +256,16 @@ namespace UnifiedEngine {
 
 			//Write data if exists
 			if (Data) {
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, this->width, this->height, 0, GL_RGB, GL_UNSIGNED_BYTE, Data);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, this->width, this->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, Data);
 				glGenerateMipmap(GL_TEXTURE_2D);
 			}
 
 			//Free Binding
 			glActiveTexture(0);
 			glBindTexture(GL_TEXTURE_2D, 0);
+
+			//Later frames of this size stream into the same storage
+			this->CreateStreamBuffers();
 		}
 
 		//Get Texture Id for manuall binding
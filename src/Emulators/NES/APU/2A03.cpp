@@ -1,5 +1,8 @@
 #include <Emulators/NES/APU/2A03.h>
 
+#include <algorithm>
+#include <cmath>
+
 using namespace UnifiedEmulation;
 using namespace NES;
 
@@ -8,187 +11,211 @@ uint8_t APU2A03::length_table[] = {  10, 254, 20,  2, 40,  4, 80,  6,
 							         12,  16, 24, 18, 48, 20, 96, 22,
 							        192,  24, 72, 26, 16, 28, 32, 30 };
 
+const uint8_t APU2A03::nTimerSteps[CHANNEL_COUNT] = { 1, 1, 2, 1 };
+
+int32_t APU2A03::pulse_table[31];
+int32_t APU2A03::tnd_table[203];
+std::once_flag APU2A03::MixTablesBuilt;
+
 APU2A03::APU2A03(){
-	noise_seq.sequence = 0xDBDB;
-	noise_seq.sequence = 0xDBDB;
+	std::call_once(MixTablesBuilt, BuildMixTables);
+
+	channel.sequence[NOISE] = 0xDBDB;
+	channel.sequence[NOISE] = 0xDBDB;
+
+	//The apu is clocked on every master clock
+	blip.SetRates(dClockRate, dSampleRate);
 }
 
 APU2A03::~APU2A03(){
 	
 }
 
+void APU2A03::BuildMixTables(){
+	//Standard approximation of the 2A03 output resistor networks
+	pulse_table[0] = 0;
+	for (int n = 1; n < 31; n++)
+		pulse_table[n] = (int32_t)lround(95.52 / (8128.0 / n + 100.0) * 65536.0);
+
+	tnd_table[0] = 0;
+	for (int n = 1; n < 203; n++)
+		tnd_table[n] = (int32_t)lround(163.67 / (24329.0 / n + 100.0) * 65536.0);
+}
+
 void APU2A03::cpuWrite(uint16_t addr, uint8_t data){
+	bLevelDirty = true;
+
     switch (addr)
 	{
 	case 0x4000:
 		switch ((data & 0xC0) >> 6){
-		case 0x00: pulse1_seq.new_sequence = 0b01000000; pulse1_osc.dutycycle = 0.125; break;
-		case 0x01: pulse1_seq.new_sequence = 0b01100000; pulse1_osc.dutycycle = 0.250; break;
-		case 0x02: pulse1_seq.new_sequence = 0b01111000; pulse1_osc.dutycycle = 0.500; break;
-		case 0x03: pulse1_seq.new_sequence = 0b10011111; pulse1_osc.dutycycle = 0.750; break;
+		case 0x00: channel.new_sequence[PULSE1] = 0b01000000; break;
+		case 0x01: channel.new_sequence[PULSE1] = 0b01100000; break;
+		case 0x02: channel.new_sequence[PULSE1] = 0b01111000; break;
+		case 0x03: channel.new_sequence[PULSE1] = 0b10011111; break;
 		}
-		pulse1_seq.sequence = pulse1_seq.new_sequence;
-		pulse1_halt = (data & 0x20);
-		pulse1_env.volume = (data & 0x0F);
-		pulse1_env.disable = (data & 0x10);
+		channel.sequence[PULSE1] = channel.new_sequence[PULSE1];
+		channel.halt[PULSE1] = (data & 0x20);
+		env[PULSE1].volume = (data & 0x0F);
+		env[PULSE1].disable = (data & 0x10);
 		break;
 
 	case 0x4001:
-		pulse1_sweep.enabled = data & 0x80;
-		pulse1_sweep.period = (data & 0x70) >> 4;
-		pulse1_sweep.down = data & 0x08;
-		pulse1_sweep.shift = data & 0x07;
-		pulse1_sweep.reload = true;
+		sweep[0].enabled = data & 0x80;
+		sweep[0].period = (data & 0x70) >> 4;
+		sweep[0].down = data & 0x08;
+		sweep[0].shift = data & 0x07;
+		sweep[0].reload = true;
 		break;
 
 	case 0x4002:
-		pulse1_seq.reload = (pulse1_seq.reload & 0xFF00) | data;
+		channel.reload[PULSE1] = (channel.reload[PULSE1] & 0xFF00) | data;
 		break;
 
 	case 0x4003:
-		pulse1_seq.reload = (uint16_t)((data & 0x07)) << 8 | (pulse1_seq.reload & 0x00FF);
-		pulse1_seq.timer = pulse1_seq.reload;
-		pulse1_seq.sequence = pulse1_seq.new_sequence;
-		pulse1_lc.counter = length_table[(data & 0xF8) >> 3];
-		pulse1_env.start = true;
+		channel.reload[PULSE1] = (uint16_t)((data & 0x07)) << 8 | (channel.reload[PULSE1] & 0x00FF);
+		channel.timer[PULSE1] = channel.reload[PULSE1];
+		channel.sequence[PULSE1] = channel.new_sequence[PULSE1];
+		lc[PULSE1].counter = length_table[(data & 0xF8) >> 3];
+		env[PULSE1].start = true;
 		break;
 
 	case 0x4004:
 		switch ((data & 0xC0) >> 6){
-		case 0x00: pulse2_seq.new_sequence = 0b01000000; pulse2_osc.dutycycle = 0.125; break;
-		case 0x01: pulse2_seq.new_sequence = 0b01100000; pulse2_osc.dutycycle = 0.250; break;
-		case 0x02: pulse2_seq.new_sequence = 0b01111000; pulse2_osc.dutycycle = 0.500; break;
-		case 0x03: pulse2_seq.new_sequence = 0b10011111; pulse2_osc.dutycycle = 0.750; break;
+		case 0x00: channel.new_sequence[PULSE2] = 0b01000000; break;
+		case 0x01: channel.new_sequence[PULSE2] = 0b01100000; break;
+		case 0x02: channel.new_sequence[PULSE2] = 0b01111000; break;
+		case 0x03: channel.new_sequence[PULSE2] = 0b10011111; break;
 		}
-		pulse2_seq.sequence = pulse2_seq.new_sequence;
-		pulse2_halt = (data & 0x20);
-		pulse2_env.volume = (data & 0x0F);
-		pulse2_env.disable = (data & 0x10);
+		channel.sequence[PULSE2] = channel.new_sequence[PULSE2];
+		channel.halt[PULSE2] = (data & 0x20);
+		env[PULSE2].volume = (data & 0x0F);
+		env[PULSE2].disable = (data & 0x10);
 		break;
 
 	case 0x4005:
-		pulse2_sweep.enabled = data & 0x80;
-		pulse2_sweep.period = (data & 0x70) >> 4;
-		pulse2_sweep.down = data & 0x08;
-		pulse2_sweep.shift = data & 0x07;
-		pulse2_sweep.reload = true;
+		sweep[1].enabled = data & 0x80;
+		sweep[1].period = (data & 0x70) >> 4;
+		sweep[1].down = data & 0x08;
+		sweep[1].shift = data & 0x07;
+		sweep[1].reload = true;
 		break;
 
 	case 0x4006:
-		pulse2_seq.reload = (pulse2_seq.reload & 0xFF00) | data;
+		channel.reload[PULSE2] = (channel.reload[PULSE2] & 0xFF00) | data;
 		break;
 
 	case 0x4007:
-		pulse2_seq.reload = (uint16_t)((data & 0x07)) << 8 | (pulse2_seq.reload & 0x00FF);
-		pulse2_seq.timer = pulse2_seq.reload;
-		pulse2_seq.sequence = pulse2_seq.new_sequence;
-		pulse2_lc.counter = length_table[(data & 0xF8) >> 3];
-		pulse2_env.start = true;
+		channel.reload[PULSE2] = (uint16_t)((data & 0x07)) << 8 | (channel.reload[PULSE2] & 0x00FF);
+		channel.timer[PULSE2] = channel.reload[PULSE2];
+		channel.sequence[PULSE2] = channel.new_sequence[PULSE2];
+		lc[PULSE2].counter = length_table[(data & 0xF8) >> 3];
+		env[PULSE2].start = true;
 		break;
 
 	case 0x4008:
 		triangle_linc.control = (data & 0x80);
-		triangle_halt = (data & 0x80);
+		channel.halt[TRIANGLE] = (data & 0x80);
 		triangle_linc.reload = (data & 0x7F);
 		break;
 	
 	case 0x400A:
-		triangle_seq.reload = (triangle_seq.reload & 0xFF00) | data;
-		//triangle_seq.timer = triangle_seq.reload & 0x00FF;
+		channel.reload[TRIANGLE] = (channel.reload[TRIANGLE] & 0xFF00) | data;
+		//channel.timer[TRIANGLE] = channel.reload[TRIANGLE] & 0x00FF;
 		break;
 
 	case 0x400B:
-		triangle_seq.reload = (uint16_t)((data & 0x07)) << 4 | (triangle_seq.reload & 0x00FF);
-		//triangle_seq.timer = (triangle_seq.reload & 0x07) | triangle_seq.timer;
-		triangle_lc.counter = (data & 0x0F8) >> 3;
+		channel.reload[TRIANGLE] = (uint16_t)((data & 0x07)) << 8 | (channel.reload[TRIANGLE] & 0x00FF);
+		//channel.timer[TRIANGLE] = (channel.reload[TRIANGLE] & 0x07) | channel.timer[TRIANGLE];
+		lc[TRIANGLE].counter = length_table[(data & 0xF8) >> 3];
 		//triangle_linc.reload = (data & 0x0F8) >> 3;
 		break;
 
 	case 0x400C:
-		noise_env.volume = (data & 0x0F);
-		noise_env.disable = (data & 0x10);
-		noise_halt = (data & 0x20);
+		env[NOISE].volume = (data & 0x0F);
+		env[NOISE].disable = (data & 0x10);
+		channel.halt[NOISE] = (data & 0x20);
 		break;
 
 	case 0x400E:
 		/*switch (data & 0x0F){
-		case 0x00: noise_seq.reload = 0; break;
-		case 0x01: noise_seq.reload = 4; break;
-		case 0x02: noise_seq.reload = 8; break;
-		case 0x03: noise_seq.reload = 16; break;
-		case 0x04: noise_seq.reload = 32; break;
-		case 0x05: noise_seq.reload = 64; break;
-		case 0x06: noise_seq.reload = 96; break;
-		case 0x07: noise_seq.reload = 128; break;
-		case 0x08: noise_seq.reload = 160; break;
-		case 0x09: noise_seq.reload = 202; break;
-		case 0x0A: noise_seq.reload = 254; break;
-		case 0x0B: noise_seq.reload = 380; break;
-		case 0x0C: noise_seq.reload = 508; break;
-		case 0x0D: noise_seq.reload = 1016; break;
-		case 0x0E: noise_seq.reload = 2034; break;
-		case 0x0F: noise_seq.reload = 4068; break;
+		case 0x00: channel.reload[NOISE] = 0; break;
+		case 0x01: channel.reload[NOISE] = 4; break;
+		case 0x02: channel.reload[NOISE] = 8; break;
+		case 0x03: channel.reload[NOISE] = 16; break;
+		case 0x04: channel.reload[NOISE] = 32; break;
+		case 0x05: channel.reload[NOISE] = 64; break;
+		case 0x06: channel.reload[NOISE] = 96; break;
+		case 0x07: channel.reload[NOISE] = 128; break;
+		case 0x08: channel.reload[NOISE] = 160; break;
+		case 0x09: channel.reload[NOISE] = 202; break;
+		case 0x0A: channel.reload[NOISE] = 254; break;
+		case 0x0B: channel.reload[NOISE] = 380; break;
+		case 0x0C: channel.reload[NOISE] = 508; break;
+		case 0x0D: channel.reload[NOISE] = 1016; break;
+		case 0x0E: channel.reload[NOISE] = 2034; break;
+		case 0x0F: channel.reload[NOISE] = 4068; break;
 		}*/
 		switch(data & 0x80){
 			case 1:
 				switch (data & 0x0F){
-				case 0x00: noise_seq.reload = 4; break;
-				case 0x01: noise_seq.reload = 8; break;
-				case 0x02: noise_seq.reload = 16; break;
-				case 0x03: noise_seq.reload = 32; break;
-				case 0x04: noise_seq.reload = 64; break;
-				case 0x05: noise_seq.reload = 96; break;
-				case 0x06: noise_seq.reload = 128; break;
-				case 0x07: noise_seq.reload = 160; break;
-				case 0x08: noise_seq.reload = 202; break;
-				case 0x09: noise_seq.reload = 254; break;
-				case 0x0A: noise_seq.reload = 380; break;
-				case 0x0B: noise_seq.reload = 508; break;
-				case 0x0C: noise_seq.reload = 762; break;
-				case 0x0D: noise_seq.reload = 1016; break;
-				case 0x0E: noise_seq.reload = 2034; break;
-				case 0x0F: noise_seq.reload = 4068; break;
+				case 0x00: channel.reload[NOISE] = 4; break;
+				case 0x01: channel.reload[NOISE] = 8; break;
+				case 0x02: channel.reload[NOISE] = 16; break;
+				case 0x03: channel.reload[NOISE] = 32; break;
+				case 0x04: channel.reload[NOISE] = 64; break;
+				case 0x05: channel.reload[NOISE] = 96; break;
+				case 0x06: channel.reload[NOISE] = 128; break;
+				case 0x07: channel.reload[NOISE] = 160; break;
+				case 0x08: channel.reload[NOISE] = 202; break;
+				case 0x09: channel.reload[NOISE] = 254; break;
+				case 0x0A: channel.reload[NOISE] = 380; break;
+				case 0x0B: channel.reload[NOISE] = 508; break;
+				case 0x0C: channel.reload[NOISE] = 762; break;
+				case 0x0D: channel.reload[NOISE] = 1016; break;
+				case 0x0E: channel.reload[NOISE] = 2034; break;
+				case 0x0F: channel.reload[NOISE] = 4068; break;
 				}
 				break;
 			case 0:
 				switch (data & 0x0F){
-				case 0x00: noise_seq.reload = 4; break;
-				case 0x01: noise_seq.reload = 8; break;
-				case 0x02: noise_seq.reload = 14; break;
-				case 0x03: noise_seq.reload = 30; break;
-				case 0x04: noise_seq.reload = 60; break;
-				case 0x05: noise_seq.reload = 88; break;
-				case 0x06: noise_seq.reload = 118; break;
-				case 0x07: noise_seq.reload = 148; break;
-				case 0x08: noise_seq.reload = 188; break;
-				case 0x09: noise_seq.reload = 236; break;
-				case 0x0A: noise_seq.reload = 354; break;
-				case 0x0B: noise_seq.reload = 472; break;
-				case 0x0C: noise_seq.reload = 708; break;
-				case 0x0D: noise_seq.reload = 944; break;
-				case 0x0E: noise_seq.reload = 1890; break;
-				case 0x0F: noise_seq.reload = 3778; break;
+				case 0x00: channel.reload[NOISE] = 4; break;
+				case 0x01: channel.reload[NOISE] = 8; break;
+				case 0x02: channel.reload[NOISE] = 14; break;
+				case 0x03: channel.reload[NOISE] = 30; break;
+				case 0x04: channel.reload[NOISE] = 60; break;
+				case 0x05: channel.reload[NOISE] = 88; break;
+				case 0x06: channel.reload[NOISE] = 118; break;
+				case 0x07: channel.reload[NOISE] = 148; break;
+				case 0x08: channel.reload[NOISE] = 188; break;
+				case 0x09: channel.reload[NOISE] = 236; break;
+				case 0x0A: channel.reload[NOISE] = 354; break;
+				case 0x0B: channel.reload[NOISE] = 472; break;
+				case 0x0C: channel.reload[NOISE] = 708; break;
+				case 0x0D: channel.reload[NOISE] = 944; break;
+				case 0x0E: channel.reload[NOISE] = 1890; break;
+				case 0x0F: channel.reload[NOISE] = 3778; break;
 				}
 				break;
 		}
 		break;
 
 	case 0x4015: // APU STATUS
-		pulse1_enable = data & 0x01;
-		pulse2_enable = data & 0x02;
-		triangle_enable = data & 0x04;
-		noise_enable = data & 0x08;
+		channel.enable[PULSE1] = data & 0x01;
+		channel.enable[PULSE2] = data & 0x02;
+		channel.enable[TRIANGLE] = data & 0x04;
+		channel.enable[NOISE] = data & 0x08;
 		break;
 
 	case 0x400F:
-		pulse1_env.start = true;
-		pulse2_env.start = true;
-		noise_env.start = true;
-		noise_lc.counter = length_table[(data & 0xF8) >> 3];
+		env[PULSE1].start = true;
+		env[PULSE2].start = true;
+		env[NOISE].start = true;
+		lc[NOISE].counter = length_table[(data & 0xF8) >> 3];
 		break;
 	case 0x4017:
 		triangle_linc.control = (data & 0x80);
-		triangle_halt = (data & 0x80);
+		channel.halt[TRIANGLE] = (data & 0x80);
 		break;
 	}
 }
@@ -197,190 +224,220 @@ uint8_t APU2A03::cpuRead(uint16_t addr){
     return 0x00;
 }
 
-#include <iostream>
-
 void APU2A03::clock(){
-	bool bQuarterFrameClock = false;
-	bool bHalfFrameClock = false;
-
-	dGlobalTime += (0.3333333333333 / 1789773);
-
-    if(clock_counter % 6 == 0){
-		frame_clock_counter++;
+	Run(1);
+}
 
-		
-		// 4-Step Sequence Mode
-		if (frame_clock_counter == 3729)
-		{
-			bQuarterFrameClock = true;
+void APU2A03::Run(uint32_t nClocks){
+	while (nClocks > 0){
+		//Clocks between apu steps only move the sweepers
+		uint32_t nToStep = (6 - clock_counter % 6) % 6;
+		if (nToStep > 0){
+			uint32_t nAdvance = std::min(nToStep, nClocks);
+			clock_counter += nAdvance;
+			AdvanceSampleClock(nAdvance);
+			nClocks -= nAdvance;
+			Track();
+			continue;
 		}
 
-		if (frame_clock_counter == 7457)
-		{
-			bQuarterFrameClock = true;
-			bHalfFrameClock = true;
+		//Jump the timers and frame counter over steps where nothing expires
+		uint32_t nSteps = (nClocks + 5) / 6;
+		uint32_t nEvent = StepsUntilEvent();
+		uint32_t nSkip = std::min(nEvent - 1, nSteps);
+		if (nSkip > 0){
+			bool bRunning[CHANNEL_COUNT] = { channel.enable[PULSE1], channel.enable[PULSE2], TriangleRunning(), channel.enable[NOISE] };
+			for (int c = 0; c < CHANNEL_COUNT; c++)
+				if (bRunning[c])
+					channel.timer[c] -= nSkip * nTimerSteps[c];
+			frame_clock_counter += nSkip;
+
+			//No event before the end of the run, finish on the clocks after the last step
+			uint32_t nAdvance = std::min(nSkip * 6, nClocks);
+			clock_counter += nAdvance;
+			AdvanceSampleClock(nAdvance);
+			nClocks -= nAdvance;
+			if (nSkip == nSteps)
+				continue;
 		}
 
-		if (frame_clock_counter == 11186)
-		{
-			bQuarterFrameClock = true;
-		}
+		Step();
+		Track();
+		clock_counter++;
+		AdvanceSampleClock(1);
+		nClocks--;
+	}
+}
 
-		if (frame_clock_counter == 14916)
-		{
-			bQuarterFrameClock = true;
-			bHalfFrameClock = true;
-			frame_clock_counter = 0;
-		}
+uint32_t APU2A03::StepsUntilEvent(){
+	if (bLevelDirty)
+		return 1;
 
-		// Update functional units
+	uint32_t nNext = 3729;
+	if (frame_clock_counter >= 3729) nNext = 7457;
+	if (frame_clock_counter >= 7457) nNext = 11186;
+	if (frame_clock_counter >= 11186) nNext = 14916;
+	uint32_t nSteps = nNext - frame_clock_counter;
 
-		// Quater frame "beats" adjust the volume envelope
-		if (bQuarterFrameClock)
-		{
-			pulse1_env.clock(pulse1_halt);
-			pulse2_env.clock(pulse2_halt);
-			noise_env.clock(noise_halt);
-		}
+	//A timer expires on the step that takes it past zero
+	bool bRunning[CHANNEL_COUNT] = { channel.enable[PULSE1], channel.enable[PULSE2], TriangleRunning(), channel.enable[NOISE] };
+	for (int c = 0; c < CHANNEL_COUNT; c++)
+		if (bRunning[c])
+			nSteps = std::min<uint32_t>(nSteps, (channel.timer[c] + nTimerSteps[c]) / nTimerSteps[c]);
 
-		// hald frame "beats" adjust the volume envelope
-		if (bHalfFrameClock)
-		{
-			pulse1_lc.clock(pulse1_enable, pulse1_halt);
-			pulse2_lc.clock(pulse2_enable, pulse2_halt);
-			noise_lc.clock(noise_enable, noise_halt);
-			triangle_lc.clock(triangle_enable, triangle_halt);
-			triangle_linc.clock(triangle_enable);
-			pulse1_sweep.clock(pulse1_seq.reload, 0);
-			pulse2_sweep.clock(pulse2_seq.reload, 1);
-		}
+	return nSteps;
+}
 
-		//Pulse 1
-		pulse1_osc.frequency = 1789773.0 / (16.0 * (double)(pulse1_seq.reload + 1));
-		pulse1_osc.amplitude = (double)(pulse1_env.output -1) / 16.0;
-		pulse1_sample = pulse1_osc.sample(dGlobalTime);
+void APU2A03::Step(){
+	bool bQuarterFrameClock = false;
+	bool bHalfFrameClock = false;
 
-		if (pulse1_lc.counter > 0 && pulse1_seq.timer >= 8 && !pulse1_sweep.mute && pulse1_env.output > 2)
-			pulse1_output += (pulse1_sample - pulse1_output) * 0.5;
-		else
-			pulse1_output = 0;
+	frame_clock_counter++;
+
+	
+	// 4-Step Sequence Mode
+	if (frame_clock_counter == 3729)
+	{
+		bQuarterFrameClock = true;
+	}
+
+	if (frame_clock_counter == 7457)
+	{
+		bQuarterFrameClock = true;
+		bHalfFrameClock = true;
+	}
 
+	if (frame_clock_counter == 11186)
+	{
+		bQuarterFrameClock = true;
+	}
 
-		//if (bUseRawMode)
-		{
-			// Update Pulse1 Channel ================================
-			pulse1_seq.clock(pulse1_enable, [](uint32_t &s){
-				// Shift right by 1 bit, wrapping around
-				s = ((s & 0x0001) << 7) | ((s & 0x00FE) >> 1);
-			});
+	if (frame_clock_counter == 14916)
+	{
+		bQuarterFrameClock = true;
+		bHalfFrameClock = true;
+		frame_clock_counter = 0;
+	}
 
-			//pulse1_sample = (double)pulse1_seq.output;
-		}
-		//else
-		{
-			pulse1_osc.frequency = 1789773.0 / (16.0 * (double)(pulse1_seq.reload + 1));
-			pulse1_osc.amplitude = (double)(pulse1_env.output -1) / 16.0;
-			pulse1_sample = pulse1_osc.sample(dGlobalTime);
-
-			if (pulse1_lc.counter > 0 && pulse1_seq.timer >= 8 && !pulse1_sweep.mute && pulse1_env.output > 2)
-				pulse1_output += (pulse1_sample - pulse1_output) * 0.5;
-			else
-				pulse1_output = 0;
-		}
+	// Update functional units
 
-		//if (bUseRawMode)
-		{
-			// Update Pulse1 Channel ================================
-			pulse2_seq.clock(pulse2_enable, [](uint32_t &s){
-				// Shift right by 1 bit, wrapping around
-				s = ((s & 0x0001) << 7) | ((s & 0x00FE) >> 1);
-			});
+	// Quater frame "beats" adjust the volume envelope
+	if (bQuarterFrameClock)
+	{
+		env[PULSE1].clock(channel.halt[PULSE1]);
+		env[PULSE2].clock(channel.halt[PULSE2]);
+		env[NOISE].clock(channel.halt[NOISE]);
+	}
 
-			//pulse2_sample = (double)pulse2_seq.output;
+	// hald frame "beats" adjust the volume envelope
+	if (bHalfFrameClock)
+	{
+		lc[PULSE1].clock(channel.enable[PULSE1], channel.halt[PULSE1]);
+		lc[PULSE2].clock(channel.enable[PULSE2], channel.halt[PULSE2]);
+		lc[NOISE].clock(channel.enable[NOISE], channel.halt[NOISE]);
+		lc[TRIANGLE].clock(channel.enable[TRIANGLE], channel.halt[TRIANGLE]);
+		triangle_linc.clock(channel.enable[TRIANGLE]);
+		sweep[0].clock(channel.reload[PULSE1], 0);
+		sweep[1].clock(channel.reload[PULSE2], 1);
+	}
 
-		}
-		//else
-		{
-			pulse2_osc.frequency = 1789773.0 / (16.0 * (double)(pulse2_seq.reload + 1));
-			pulse2_osc.amplitude = (double)(pulse2_env.output-1) / 16.0;
-			pulse2_sample = pulse2_osc.sample(dGlobalTime);
-
-			if (pulse2_lc.counter > 0 && pulse2_seq.timer >= 8 && !pulse2_sweep.mute && pulse2_env.output > 2)
-				pulse2_output += (pulse2_sample - pulse2_output) * 0.5;
-			else
-				pulse2_output = 0;
-		}
+	// Update Pulse Channels ================================
+	ClockTimer<PulseRotate>(PULSE1, channel.enable[PULSE1]);
+	ClockTimer<PulseRotate>(PULSE2, channel.enable[PULSE2]);
+
+	for (int i = 0; i < 2; i++){
+		CHANNEL c = (CHANNEL)(PULSE1 + i);
+		if (channel.enable[c] && lc[c].counter > 0 && channel.reload[c] >= 8 && !sweep[i].mute)
+			SetLevel(c, channel.output[c] * env[c].output);
+		else
+			SetLevel(c, 0);
+	}
 
+	// Update Noise Channel =================================
+	ClockTimer<NoiseShift>(NOISE, channel.enable[NOISE]);
 
-		noise_seq.clock(noise_enable, [](uint32_t &s){
-				s = (((s & 0x0001) ^ ((s & 0x0002) >> 1)) << 14) | ((s & 0x7FFF) >> 1);
-		});
+	if (channel.enable[NOISE] && lc[NOISE].counter > 0)
+		SetLevel(NOISE, channel.output[NOISE] * env[NOISE].output);
+	else
+		SetLevel(NOISE, 0);
 
-		if (noise_lc.counter > 0 && noise_seq.timer >= 8){
-			noise_output = (double)noise_seq.output * ((double)(noise_env.output-1) / 16.0);
-		}
-		else{
-			noise_output = 0;
-		}
+	// Update Triangle Channel ==============================
+	// The triangle timer runs at the cpu rate, twice per apu step, and holds its level when stopped
+	bool bTriangleRun = TriangleRunning();
+	ClockTimer<TriangleStep>(TRIANGLE, bTriangleRun);
+	ClockTimer<TriangleStep>(TRIANGLE, bTriangleRun);
 
-		//if(triangle_lc.counter > 0 && triangle_linc.reload > 0 && !triangle_halt){
-
-		//	triangle_seq.clock(triangle_enable, [](uint32_t &s){
-				// Shift right by 1 bit, wrapping around
-				//s = (((s & 0x0001) ^ ((s & 0x0002) >> 1)) << 14) | ((s & 0x7FFF) >> 1);
-		//	});
-
-			//triangle_osc.frequency = 1789773.0 / (32.0 * (double)(triangle_seq.reload + 1));
-			//triangle_osc.amplitude = (double)(triangle_seq.output-1) / 32.0;
-			//triangle_sample = triangle_osc.sample(dGlobalTime);
-			//triangle_output += (triangle_sample - triangle_output) * 0.5;
-			
-			//triangle_output += 1.789773/(32*(triangle_seq.reload + 1));
-			//triangle_seq.reload = 1.789773/(32*triangle_output) -1;
-			
-			//if(triangle_output != 0)
-				//std::cout << triangle_output << std::endl;
-		//}
-		//else{
-			//triangle_output = 0;
-		//}
-
-		//triangle_output = triangle_seq.reload / 55930.4;
-		//if(triangle_output != 0)
-				//std::cout << triangle_output << std::endl;
-
-		if (!pulse1_enable) pulse1_output = 0;
-		if (!pulse2_enable) pulse2_output = 0;
-		if (!triangle_enable) triangle_output = 0;
-		if (!noise_enable) noise_output = 0;
+	uint32_t nStep = channel.sequence[TRIANGLE];
+	SetLevel(TRIANGLE, (nStep < 16) ? 15 - nStep : nStep - 16);
 
-	}
+	bLevelDirty = false;
+}
+
+void APU2A03::Track(){
+	bool bMute[2] = { sweep[0].mute, sweep[1].mute };
 
 	// Frequency sweepers change at high frequency
-	pulse1_sweep.track(pulse1_seq.reload);
-	pulse2_sweep.track(pulse2_seq.reload);
+	sweep[0].track(channel.reload[PULSE1]);
+	sweep[1].track(channel.reload[PULSE2]);
 
-	pulse1_visual = (pulse1_enable && pulse1_env.output > 1 && !pulse1_sweep.mute) ? pulse1_seq.reload : 2047;
-	pulse2_visual = (pulse2_enable && pulse2_env.output > 1 && !pulse2_sweep.mute) ? pulse2_seq.reload : 2047;
-	noise_visual = (noise_enable && noise_env.output > 1) ? noise_seq.reload : 2047;
-	//triangle_visual = (triangle_enable && triangle_output > 1) ? triangle_seq.reload : 2047;
-	triangle_visual = (triangle_enable) ? triangle_seq.reload : 2047;
+	//A sweeper muting or unmuting its channel changes the level on the next step
+	if (sweep[0].mute != bMute[0] || sweep[1].mute != bMute[1])
+		bLevelDirty = true;
+}
 
-	clock_counter++;
+uint32_t APU2A03::ClocksUntilFrameStep(){
+	uint32_t nNext = 3729;
+	if (frame_clock_counter >= 3729) nNext = 7457;
+	if (frame_clock_counter >= 7457) nNext = 11186;
+	if (frame_clock_counter >= 11186) nNext = 14916;
+
+	//The frame counter advances on every sixth clock
+	uint32_t nFirst = (6 - clock_counter % 6) % 6;
+	return nFirst + (nNext - frame_clock_counter - 1) * 6;
 }
 
 void APU2A03::reset(){
-    
+	blip.Clear();
+	nSampleClock = 0;
+	nSampleRead = nSampleWrite;
+	for (int c = 0; c < CHANNEL_COUNT; c++)
+		channel.level[c] = 0;
+	nMixLevel = 0;
+	bLevelDirty = true;
 }
 
-double APU2A03::GetOutputSample(){
-	if (bUseRawMode){
-		return (pulse1_sample - 0.5) * 0.5
-			+ (pulse2_sample - 0.5) * 0.5;
-	}
-	else{
-		return ((1.0 * pulse1_output) - 0.8) * 0.1 +
-			((1.0 * pulse2_output) - 0.8) * 0.1 +
-			((2.0 * triangle_output + 2.0 * (noise_output - 0.5))) * 0.1;
+void APU2A03::Serialize(StateStream& s){
+	s.Field(frame_clock_counter);
+	s.Field(clock_counter);
+	s.Field(channel);
+	s.Field(env);
+	s.Field(lc);
+	s.Field(sweep);
+	s.Field(triangle_linc);
+	s.Field(blip);
+	s.Field(nSampleClock);
+	s.Field(nMixLevel);
+	s.Field(bLevelDirty);
+}
+
+void APU2A03::EmitSample(){
+	//Full buffer, nobody is reading so lose the oldest
+	if (nSampleWrite - nSampleRead == nSampleBufferSize)
+		nSampleRead++;
+	fSamples[nSampleWrite++ & (nSampleBufferSize - 1)] = (float)(blip.ReadSample() / 65536.0);
+
+	//Scope entries are taken on the emulation thread, so viewing them costs nothing here
+	if (++nScopeCount == nScopeDecimation){
+		nScopeCount = 0;
+		for (int c = 0; c < CHANNEL_COUNT; c++)
+			scope[c][nScopeWrite & (nScopeSize - 1)] = channel.level[c];
+		nScopeWrite++;
 	}
-}
\ No newline at end of file
+}
+
+size_t APU2A03::ReadSamples(float* pOut, size_t nMax){
+	size_t nCount = std::min<size_t>(nMax, nSampleWrite - nSampleRead);
+	for (size_t i = 0; i < nCount; i++)
+		pOut[i] = fSamples[nSampleRead++ & (nSampleBufferSize - 1)];
+	return nCount;
+}
@@ -0,0 +1,84 @@
+#include <Emulators/NES/APU/BlipBuffer.h>
+
+#include <cmath>
+#include <cstring>
+
+using namespace UnifiedEmulation;
+using namespace NES;
+
+int32_t BlipBuffer::step_table[BlipBuffer::nPhases][BlipBuffer::nTaps];
+std::once_flag BlipBuffer::TableBuilt;
+
+BlipBuffer::BlipBuffer(){
+	std::call_once(TableBuilt, BuildStepTable);
+
+	SetRates(5369318.0, 44100.0);
+	Clear();
+}
+
+void BlipBuffer::BuildStepTable(){
+	const double pi = 3.14159265358979323846;
+	//Cut off a little under nyquist, the window does the rest
+	const double cutoff = 0.45;
+	const double half = nTaps / 2;
+
+	for (int p = 0; p < nPhases; p++){
+		double kernel[nTaps];
+		double sum = 0.0;
+
+		for (int i = 0; i < nTaps; i++){
+			//Tap i lands (i + 1 - half) samples after the step, less the step's offset into its sample
+			double t = (i + 1 - half) - (double)p / nPhases;
+			double x = 2.0 * pi * cutoff * t;
+			double sinc = (t == 0.0) ? 1.0 : sin(x) / x;
+			double window = 0.42 + 0.5 * cos(pi * t / half) + 0.08 * cos(2.0 * pi * t / half);
+
+			kernel[i] = sinc * window;
+			sum += kernel[i];
+		}
+
+		//Round to fixed point and give the rounding error to the largest tap
+		int32_t total = 0;
+		int largest = 0;
+		for (int i = 0; i < nTaps; i++){
+			step_table[p][i] = (int32_t)lround(kernel[i] / sum * (1 << nKernelBits));
+			total += step_table[p][i];
+			if (step_table[p][i] > step_table[p][largest])
+				largest = i;
+		}
+		step_table[p][largest] += (1 << nKernelBits) - total;
+	}
+}
+
+void BlipBuffer::SetRates(double dClockRate, double dSampleRate){
+	nSamplesPerClock = (uint64_t)llround(dSampleRate / dClockRate * 4294967296.0);
+}
+
+void BlipBuffer::Clear(){
+	memset(buffer, 0, sizeof(buffer));
+	nRead = 0;
+	nIntegrator = 0;
+}
+
+void BlipBuffer::AddDelta(uint32_t nClock, int32_t nDelta){
+	uint64_t nPosition = (uint64_t)nClock * nSamplesPerClock;
+	uint32_t nSample = (uint32_t)(nPosition >> 32);
+	uint32_t nPhase = (uint32_t)(nPosition >> (32 - nPhaseBits)) & (nPhases - 1);
+
+	//Samples not read for a long time, keep the step inside the buffer
+	if (nSample > nBufferSize - nTaps)
+		nSample = nBufferSize - nTaps;
+
+	const int32_t* kernel = step_table[nPhase];
+	uint32_t nStart = nRead + nSample;
+	for (int i = 0; i < nTaps; i++)
+		buffer[(nStart + i) & (nBufferSize - 1)] += (int64_t)kernel[i] * nDelta;
+}
+
+int32_t BlipBuffer::ReadSample(){
+	nIntegrator += buffer[nRead];
+	buffer[nRead] = 0;
+	nRead = (nRead + 1) & (nBufferSize - 1);
+
+	return (int32_t)(nIntegrator >> nKernelBits);
+}
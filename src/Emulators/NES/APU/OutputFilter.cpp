@@ -0,0 +1,122 @@
+#include <Emulators/NES/APU/OutputFilter.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OUTPUT_FILTER_SSE
+#endif
+
+using namespace UnifiedEmulation;
+using namespace NES;
+
+OutputFilter::OutputFilter(){
+	SetRate(44100.0);
+}
+
+void OutputFilter::SetRate(double dSampleRate){
+	const double pi = 3.14159265358979323846;
+	double dt = 1.0 / dSampleRate;
+
+	//First order rc high pass, y[n] = a * (y[n-1] + x[n] - x[n-1])
+	auto HighPass = [&](Stage& s, double dCutoff){
+		double rc = 1.0 / (2.0 * pi * dCutoff);
+		float a = (float)(rc / (rc + dt));
+		s.Design(a, a, -a);
+	};
+
+	//First order rc low pass, y[n] = y[n-1] + k * (x[n] - y[n-1])
+	auto LowPass = [&](Stage& s, double dCutoff){
+		double rc = 1.0 / (2.0 * pi * dCutoff);
+		float k = (float)(dt / (rc + dt));
+		s.Design(1.0f - k, k, 0.0f);
+	};
+
+	HighPass(stages[HIGHPASS_90], 90.0);
+	HighPass(stages[HIGHPASS_440], 440.0);
+	LowPass(stages[LOWPASS_14K], 14000.0);
+
+	Clear();
+}
+
+void OutputFilter::Clear(){
+	for (auto& s : stages){
+		s.x1 = 0.0f;
+		s.y1 = 0.0f;
+	}
+}
+
+void OutputFilter::Process(float* pSamples, size_t nSamples){
+	while (nSamples > 0){
+		size_t nBlock = std::min(nSamples, nScratchSize);
+
+		for (auto& s : stages)
+			s.Run(pSamples, nBlock, scratch);
+
+		pSamples += nBlock;
+		nSamples -= nBlock;
+	}
+}
+
+void OutputFilter::Stage::Design(float fA, float fB0, float fB1){
+	a = fA;
+	b0 = fB0;
+	b1 = fB1;
+
+	float fPow = 1.0f;
+	for (int i = 0; i < 4; i++){
+		fPow *= a;
+		fPower[i] = fPow;
+	}
+
+	for (int j = 0; j < 4; j++)
+		for (int i = 0; i < 4; i++)
+			fColumn[j][i] = (i >= j) ? powf(a, (float)(i - j)) : 0.0f;
+}
+
+void OutputFilter::Stage::Run(float* pSamples, size_t nSamples, float* pScratch){
+	//Input terms of the whole block first, nothing carried between samples so this loop vectorises
+	pScratch[0] = b0 * pSamples[0] + b1 * x1;
+	for (size_t i = 1; i < nSamples; i++)
+		pScratch[i] = b0 * pSamples[i] + b1 * pSamples[i - 1];
+	x1 = pSamples[nSamples - 1];
+
+	size_t i = 0;
+
+	//Outputs this small are taken as silence so a decaying section never runs into denormals
+	const float fSilence = 1e-15f;
+
+#ifdef OUTPUT_FILTER_SSE
+	//Four outputs at once, each the decayed last output plus the decayed inputs before it
+	__m128 power = _mm_load_ps(fPower);
+	__m128 column0 = _mm_load_ps(fColumn[0]);
+	__m128 column1 = _mm_load_ps(fColumn[1]);
+	__m128 column2 = _mm_load_ps(fColumn[2]);
+	__m128 column3 = _mm_load_ps(fColumn[3]);
+	__m128 last = _mm_set1_ps(y1);
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 tiny = _mm_set1_ps(fSilence);
+
+	for (; i + 4 <= nSamples; i += 4){
+		__m128 in = _mm_loadu_ps(pScratch + i);
+		__m128 out = _mm_mul_ps(power, last);
+		out = _mm_add_ps(out, _mm_mul_ps(column0, _mm_shuffle_ps(in, in, 0x00)));
+		out = _mm_add_ps(out, _mm_mul_ps(column1, _mm_shuffle_ps(in, in, 0x55)));
+		out = _mm_add_ps(out, _mm_mul_ps(column2, _mm_shuffle_ps(in, in, 0xAA)));
+		out = _mm_add_ps(out, _mm_mul_ps(column3, _mm_shuffle_ps(in, in, 0xFF)));
+		out = _mm_and_ps(out, _mm_cmpge_ps(_mm_andnot_ps(sign, out), tiny));
+		_mm_storeu_ps(pSamples + i, out);
+		last = _mm_shuffle_ps(out, out, 0xFF);
+	}
+
+	y1 = _mm_cvtss_f32(last);
+#endif
+
+	for (; i < nSamples; i++){
+		y1 = a * y1 + pScratch[i];
+		if (fabsf(y1) < fSilence)
+			y1 = 0.0f;
+		pSamples[i] = y1;
+	}
+}
@@ -0,0 +1,138 @@
+#include <Emulators/NES/APU/Resampler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define RESAMPLER_SSE
+#endif
+
+using namespace UnifiedEmulation;
+using namespace NES;
+
+//Window of input against a kernel blended between two phases, k0 + fBlend * (k1 - k0)
+static inline float BlendedDot(const float* pIn, const float* k0, const float* k1, float fBlend){
+#if defined(__AVX__)
+	__m256 blend = _mm256_set1_ps(fBlend);
+	__m256 acc = _mm256_setzero_ps();
+	for (int i = 0; i < Resampler::nTaps; i += 8){
+		__m256 a = _mm256_load_ps(k0 + i);
+		__m256 k = _mm256_add_ps(a, _mm256_mul_ps(blend, _mm256_sub_ps(_mm256_load_ps(k1 + i), a)));
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(pIn + i), k));
+	}
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+	return _mm_cvtss_f32(sum);
+#elif defined(RESAMPLER_SSE)
+	__m128 blend = _mm_set1_ps(fBlend);
+	__m128 acc = _mm_setzero_ps();
+	for (int i = 0; i < Resampler::nTaps; i += 4){
+		__m128 a = _mm_load_ps(k0 + i);
+		__m128 k = _mm_add_ps(a, _mm_mul_ps(blend, _mm_sub_ps(_mm_load_ps(k1 + i), a)));
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(pIn + i), k));
+	}
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+	return _mm_cvtss_f32(acc);
+#else
+	float acc = 0.0f;
+	for (int i = 0; i < Resampler::nTaps; i++)
+		acc += pIn[i] * (k0[i] + fBlend * (k1[i] - k0[i]));
+	return acc;
+#endif
+}
+
+Resampler::Resampler(){
+	SetRates(1.0, 1.0);
+}
+
+void Resampler::SetRates(double dNewInputRate, double dNewOutputRate){
+	dInputRate = dNewInputRate;
+	dOutputRate = dNewOutputRate;
+
+	const double pi = 3.14159265358979323846;
+	const double half = nTaps / 2;
+	//Pass band ends a little under the lower of the two nyquist rates, in cycles per input sample
+	const double cutoff = 0.45 * std::min(1.0, dOutputRate / dInputRate);
+
+	for (int p = 0; p <= nPhases; p++){
+		double taps[nTaps];
+		double sum = 0.0;
+
+		for (int i = 0; i < nTaps; i++){
+			//Output lands p / nPhases of a sample after input tap half - 1
+			double t = (i - (half - 1)) - (double)p / nPhases;
+			double x = 2.0 * pi * cutoff * t;
+			double sinc = (t == 0.0) ? 1.0 : sin(x) / x;
+			double window = (fabs(t) >= half) ? 0.0 : 0.42 + 0.5 * cos(pi * t / half) + 0.08 * cos(2.0 * pi * t / half);
+
+			taps[i] = sinc * window;
+			sum += taps[i];
+		}
+
+		//Unity gain at dc for every phase
+		for (int i = 0; i < nTaps; i++)
+			kernel[p][i] = (float)(taps[i] / sum);
+	}
+
+	SetRatio(dRatio);
+	Clear();
+}
+
+void Resampler::SetRatio(double dNewRatio){
+	dRatio = dNewRatio;
+	nStep = (uint64_t)llround(dInputRate / (dOutputRate * dRatio) * 4294967296.0);
+}
+
+void Resampler::Clear(){
+	//Start with a full window of silence so output begins straight away
+	std::fill(input, input + nTaps - 1, 0.0f);
+	nInputCount = nTaps - 1;
+	nPosition = 0;
+}
+
+size_t Resampler::Run(float* pOut, size_t nMaxOut){
+	size_t nOut = 0;
+
+	while (nOut < nMaxOut && (nPosition >> 32) + nTaps <= nInputCount){
+		uint32_t nFraction = (uint32_t)nPosition;
+		uint32_t nPhase = nFraction >> (32 - nPhaseBits);
+		float fBlend = (float)(nFraction & ((1u << (32 - nPhaseBits)) - 1)) * (1.0f / (float)(1u << (32 - nPhaseBits)));
+
+		pOut[nOut++] = BlendedDot(input + (nPosition >> 32), kernel[nPhase], kernel[nPhase + 1], fBlend);
+		nPosition += nStep;
+	}
+
+	//Drop the input every later output has moved past
+	size_t nUsed = std::min<size_t>(nPosition >> 32, nInputCount);
+	memmove(input, input + nUsed, (nInputCount - nUsed) * sizeof(float));
+	nInputCount -= nUsed;
+	nPosition -= (uint64_t)nUsed << 32;
+
+	return nOut;
+}
+
+size_t Resampler::Process(const float* pIn, size_t nIn, float* pOut, size_t nMaxOut){
+	size_t nOut = 0;
+
+	//Input goes through the buffer a chunk at a time, anything past a full output is dropped
+	while (nIn > 0){
+		size_t nTake = std::min(nIn, (size_t)nInputSize - nInputCount);
+		memcpy(input + nInputCount, pIn, nTake * sizeof(float));
+		nInputCount += nTake;
+		pIn += nTake;
+		nIn -= nTake;
+
+		nOut += Run(pOut + nOut, nMaxOut - nOut);
+
+		if (nTake == 0)
+			break;
+	}
+
+	return nOut;
+}
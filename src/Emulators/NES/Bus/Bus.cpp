@@ -1,5 +1,9 @@
 #include <Emulators/NES/Bus/Bus.h>
 
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
 using namespace UnifiedEmulation;
 using namespace NES;
 
@@ -8,13 +12,22 @@ Bus::Bus(){
 
     //Clear Ram
     for (auto &i : cpuRam) i = 0x00;
+
+    MapPages();
 }
 
 Bus::~Bus(){
-
+    delete pLockstep;
 }
 
-void Bus::cpuWrite(uint16_t addr, uint8_t data){
+void Bus::cpuWriteHandler(uint16_t addr, uint8_t data){
+    //Mapper registers can swap CHR banks and mirroring under the PPU
+    if(addr >= 0x8000){
+        CatchUpPPU(nCpuTick);
+        ppu.Sync();
+        bIRQDirty = true;
+    }
+
     if(cart->cpuWrite(addr, data)){
 
     }
@@ -22,19 +35,28 @@ void Bus::cpuWrite(uint16_t addr, uint8_t data){
         cpuRam[addr & 0x07FF] = data;
     }
     else if (addr >= 0x2000 && addr <= 0x3FFF){
+        CatchUpPPU(nCpuTick);
         ppu.cpuWrite(addr & 0x0007, data);
     }
     else if ((addr >= 0x4000 && addr <= 0x4013) || addr == 0x4015 || addr == 0x4017){
+        CatchUpAPU(nCpuTick);
 		apu.cpuWrite(addr, data);
 	}
     else if(addr == 0x4014){
         dma_page = data;
         dma_addr = 0x00;
         dma_transfer = true;
+        Schedule(EVENT_DMA);
     }
     else if(addr >= 0x4016 && addr <=0x4017){
         controller_state[addr & 0x001] = controller[addr & 0x0001];
     }
+
+    //Cartridge writes may have switched banks or mirroring
+    if(addr >= 0x4020 && cart->GetMapper()->nGeneration != nPageGeneration){
+        MapPages();
+        ppu.MapNameTables();
+    }
 }
 
 uint8_t Bus::ASMRead(uint16_t addr, bool bReadOnly){
@@ -63,7 +85,7 @@ uint8_t Bus::ASMRead(uint16_t addr, bool bReadOnly){
     return data;
 }
 
-uint8_t Bus::cpuRead(uint16_t addr, bool bReadOnly){
+uint8_t Bus::cpuReadHandler(uint16_t addr, bool bReadOnly){
 	uint8_t data = 0x00;
 
     if (cart->cpuRead(addr, data))
@@ -78,11 +100,13 @@ uint8_t Bus::cpuRead(uint16_t addr, bool bReadOnly){
     else if (addr >= 0x2000 && addr <= 0x3FFF)
     {
         // PPU Address range, mirrored every 8
+        CatchUpPPU(nCpuTick);
         data = ppu.cpuRead(addr & 0x0007, bReadOnly);
     }
     else if (addr == 0x4015)
     {
         // APU Read Status
+        CatchUpAPU(nCpuTick);
         data = apu.cpuRead(addr);
     }
     else if(addr >= 0x4016 && addr <=0x4017){
@@ -93,85 +117,470 @@ uint8_t Bus::cpuRead(uint16_t addr, bool bReadOnly){
 	return data;
 }
 
+void Bus::MapPages(){
+    if(cart)
+        nPageGeneration = cart->GetMapper()->nGeneration;
+
+    for(int p = 0; p < 256; p++){
+        pReadPage[p] = nullptr;
+        pWritePage[p] = nullptr;
+
+        //Cartridge takes priority, same as the handlers
+        if(cart)
+            cart->GetCPUPage(p << 8, pReadPage[p], pWritePage[p]);
+
+        if(pReadPage[p] == nullptr && p < 0x20){
+            //System RAM, mirrored every 2048
+            pWritePage[p] = &cpuRam[(p << 8) & 0x07FF];
+            pReadPage[p] = pWritePage[p];
+        }
+    }
+}
+
 void Bus::insertCartridge(const std::shared_ptr<Cartridge>& cartridge){
     this->cart = cartridge;
     ppu.ConnectCartridge(cartridge);
+
+    MapPages();
+    bScheduleDirty = true;
+
+    if(nRunMode == RUN_LOCKSTEP)
+        StartLockstep();
 }
 
 void Bus::reset(){
     cart->reset();
+    MapPages();
+    ppu.MapNameTables();
 	cpu.reset();
 	ppu.reset();
 	nSystemClockCounter = 0;
+	nCpuTick = 0;
+	nPPUTick = 0;
+	nAPUTick = 0;
 	dma_page = 0x00;
 	dma_addr = 0x00;
 	dma_data = 0x00;
 	dma_dummy = true;
 	dma_transfer = false;
+	bScheduleDirty = true;
+
+    if(pLockstep)
+        pLockstep->reset();
 }
 
 bool Bus::clock(){
+    switch (nRunMode)
+    {
+    case RUN_CATCHUP:
+        return clockCatchUp();
+    case RUN_LOCKSTEP:
+        return clockLockstep();
+    default:
+        return clockDot();
+    }
+}
+
+void Bus::clockDMA(){
+    if(dma_dummy){
+        if(nCpuTick % 2 == 1){
+            dma_dummy = false;
+        }
+    }
+    else{
+        if(nCpuTick % 2 == 0){
+            dma_data = cpuRead(dma_page << 8 | dma_addr);
+        }
+        else{
+            CatchUpPPU(nCpuTick);
+            ppu.pOAM[dma_addr] = dma_data;
+            dma_addr++;
+
+            if(dma_addr == 0x00){
+                dma_transfer = false;
+                dma_dummy = true;
+            }
+        }
+    }
+}
+
+bool Bus::clockDot(){
+    nCpuTick = nSystemClockCounter;
+
+    uint32_t nFrame = ppu.frame_count;
     ppu.clock();
+    nPPUTick = nSystemClockCounter + 1;
 
     apu.clock();
+    nAPUTick = nSystemClockCounter + 1;
 
     if(nSystemClockCounter % 3 == 0){
         if(dma_transfer){
-            if(dma_dummy){
-                if(nSystemClockCounter % 2 == 1){
-                    dma_dummy = false;
-                }
-            }
-            else{
-                if(nSystemClockCounter % 2 == 0){
-                    dma_data = cpuRead(dma_page << 8 | dma_addr);
-                }
-                else{
-                    ppu.pOAM[dma_addr] = dma_data;
-                    dma_addr++;
-
-                    if(dma_addr == 0x00){
-                        dma_transfer = false;
-                        dma_dummy = true;
-                    }
-                }
-            }
+            clockDMA();
         }
         else{
             cpu.clock();
         }
     }
 
-    //Sync with audio
-    bool bAudioSampleReady = false;
-	dAudioTime += dAudioTimePerNESClock;
-	if (dAudioTime >= dAudioTimePerSystemSample){
-		dAudioTime -= dAudioTimePerSystemSample;
-		dAudioSample = apu.GetOutputSample();
-		bAudioSampleReady = true;
-	}
-
     if(ppu.nmi){
         ppu.nmi = false;
         cpu.nmi();
     }
 
-    //if (cart->GetMapper()->irqState())
-	//{
-		//cart->GetMapper()->irqClear();
-		//cpu.irq();		
-	//}
-
+    //Only look at the mapper after it has been clocked
+    ppu.scanline_trigger = false;
+    PollIRQ(nSystemClockCounter);
 
     nSystemClockCounter++;
     
     ClockSpeedCounter++;
     SystemClockCount++;
 
-    return bAudioSampleReady;
+    return ppu.frame_count != nFrame;
+}
+
+bool Bus::clockCatchUp(uint64_t nLimit){
+    if(bScheduleDirty){
+        for(int e = 0; e < EVENT_COUNT; e++)
+            Schedule((EVENT)e);
+        bScheduleDirty = false;
+    }
+
+    //CPU slots fall on every third master clock
+    uint64_t nSlot = nSystemClockCounter + (3 - nSystemClockCounter % 3) % 3;
+    uint32_t nFrame = ppu.frame_count;
+
+    while(true){
+        //Events are taken after the CPU slot sharing their clock
+        EVENT event = NextEvent();
+        uint64_t nEvent = nEventTick[event];
+        if(nEvent < nSlot && nEvent <= nLimit){
+            RunEvent(event);
+            continue;
+        }
+
+        if(nSlot > nLimit || ppu.frame_count != nFrame)
+            break;
+
+        //Run uninterrupted up to the next event or the limit
+        uint64_t nLast = std::min(nLimit, nEvent);
+
+        if(dma_transfer){
+            while(dma_transfer && nSlot <= nLast){
+                nCpuTick = nSlot;
+                clockDMA();
+                nSlot += 3;
+            }
+        }
+        else if(cpu.cycles > 0){
+            //Skip the rest of the instruction, an interrupt resets the count so stop at events
+            uint64_t nSkip = std::min<uint64_t>(cpu.cycles, (nLast - nSlot) / 3 + 1);
+            cpu.cycles -= nSkip;
+            nSlot += nSkip * 3;
+
+            //End of the instruction, it may have cleared I with the line still held
+            if(cpu.cycles == 0)
+                PollIRQ(nSlot - 3);
+        }
+        else{
+            nCpuTick = nSlot;
+            cpu.clock();
+            nSlot += 3;
+
+            if(bIRQDirty){
+                bIRQDirty = false;
+                Schedule(EVENT_IRQ);
+            }
+        }
+    }
+
+    //Everything before the next CPU slot has run, the devices only need bringing up to it
+    uint64_t nEnd = std::min(nSlot - 1, nLimit);
+    CatchUpPPU(nEnd);
+    CatchUpAPU(nEnd);
+
+    uint64_t nTicks = nEnd + 1 - nSystemClockCounter;
+    nSystemClockCounter = nEnd + 1;
+
+    ClockSpeedCounter += nTicks;
+    SystemClockCount += nTicks;
+
+    return ppu.frame_count != nFrame;
+}
+
+void Bus::Schedule(EVENT event){
+    uint64_t nTick = UINT64_MAX;
+
+    switch (event)
+    {
+    case EVENT_VBLANK:
+        nTick = nPPUTick + ppu.DotsUntilVerticalBlank();
+        break;
+
+    case EVENT_IRQ:{
+        int nScanlines = cart->GetMapper()->irqScanlines();
+        if(nScanlines > 0)
+            nTick = nPPUTick + ppu.DotsUntilScanlineCounter(nScanlines);
+        break;
+    }
+
+    case EVENT_DMA:
+        //Transfer waits for an odd clock, then alternates read and write for 256 bytes
+        if(dma_transfer){
+            uint64_t nDummy = nCpuTick + ((nCpuTick + 3) % 2 == 1 ? 3 : 6);
+            nTick = nDummy + 6 * 256;
+        }
+        break;
+
+    case EVENT_FRAME:
+        nTick = nAPUTick + apu.ClocksUntilFrameStep();
+        break;
+
+    case EVENT_FRAMEEND:
+        nTick = nPPUTick + ppu.DotsUntilFrameEnd();
+        break;
+
+    default:
+        break;
+    }
+
+    nEventTick[event] = nTick;
+}
+
+Bus::EVENT Bus::NextEvent(){
+    EVENT next = EVENT_VBLANK;
+    for(int e = 1; e < EVENT_COUNT; e++)
+        if(nEventTick[e] < nEventTick[next])
+            next = (EVENT)e;
+    return next;
+}
+
+void Bus::RunEvent(EVENT event){
+    uint64_t nTick = nEventTick[event];
+
+    switch (event)
+    {
+    case EVENT_VBLANK:
+        CatchUpPPU(nTick);
+        if(ppu.nmi){
+            ppu.nmi = false;
+            nCpuTick = nTick;
+            cpu.nmi();
+        }
+        break;
+
+    case EVENT_IRQ:
+        CatchUpPPU(nTick);
+        ppu.scanline_trigger = false;
+        PollIRQ(nTick);
+        break;
+
+    case EVENT_DMA:
+        //Nothing to deliver, the CPU picks up on its next slot
+        nEventTick[event] = UINT64_MAX;
+        return;
+
+    case EVENT_FRAME:
+        //No frame IRQ yet, keeps envelope and length steps in time with the CPU
+        CatchUpAPU(nTick);
+        break;
+
+    case EVENT_FRAMEEND:
+        //Stops the run loop once the PPU has counted the frame
+        CatchUpPPU(nTick);
+        break;
+
+    default:
+        break;
+    }
+
+    //Estimates may be early, rescheduling from the caught up device finds the real clock
+    Schedule(event);
+}
+
+void Bus::PollIRQ(uint64_t nTick){
+    //Left raised after delivery, only the mapper's acknowledge write lowers it
+    if(cpu.cycles == 0 && cart->GetMapper()->irqState()){
+        nCpuTick = nTick;
+        cpu.irq();
+    }
+}
+
+void Bus::CatchUpPPU(uint64_t tick){
+    while(nPPUTick <= tick){
+        ppu.clock();
+        nPPUTick++;
+    }
+}
+
+void Bus::CatchUpAPU(uint64_t tick){
+    if(nAPUTick <= tick){
+        apu.Run((uint32_t)(tick + 1 - nAPUTick));
+        nAPUTick = tick + 1;
+    }
+}
+
+SaveStateHeader Bus::GetStateHeader(){
+    SaveStateHeader header;
+    header.nMapperID = cart->GetMapperID();
+    header.nPRGBanks = cart->GetPRGBanks();
+    header.nCHRBanks = cart->GetCHRBanks();
+    header.nImageHash = cart->GetImageHash();
+
+    StateStream counter;
+    counter.Field(header);
+    Serialize(counter);
+    header.nSize = (uint32_t)counter.GetSize();
+
+    return header;
+}
+
+void Bus::Serialize(StateStream& s){
+    cpu.Serialize(s);
+    ppu.Serialize(s);
+    apu.Serialize(s);
+    cart->Serialize(s);
+
+    s.Field(cpuRam);
+    s.Field(controller);
+    s.Field(controller_state);
+
+    s.Field(dma_page);
+    s.Field(dma_addr);
+    s.Field(dma_data);
+    s.Field(dma_transfer);
+    s.Field(dma_dummy);
+
+    s.Field(nSystemClockCounter);
+    s.Field(nCpuTick);
+    s.Field(nPPUTick);
+    s.Field(nAPUTick);
+}
+
+size_t Bus::GetStateSize(){
+    if(!cart)
+        return 0;
+
+    return GetStateHeader().nSize;
+}
+
+size_t Bus::SaveState(uint8_t* pBuffer, size_t nSize){
+    if(!cart)
+        return 0;
+
+    //Draw any held back dots so the PPU is exactly at its clock
+    ppu.Sync();
+
+    SaveStateHeader header = GetStateHeader();
+    StateStream s(pBuffer, nSize);
+    s.Field(header);
+    Serialize(s);
+
+    return s.Overflowed() ? 0 : s.GetSize();
+}
+
+bool Bus::LoadState(const uint8_t* pBuffer, size_t nSize){
+    if(!cart || nSize < sizeof(SaveStateHeader))
+        return false;
+
+    //Version, cartridge layout and size all have to match before anything is touched
+    SaveStateHeader header;
+    SaveStateHeader expected = GetStateHeader();
+    memcpy(&header, pBuffer, sizeof(header));
+    if(memcmp(&header, &expected, sizeof(header)) != 0 || nSize < header.nSize)
+        return false;
+
+    StateStream s(pBuffer, nSize);
+    s.Field(header);
+    Serialize(s);
+
+    //Pointers and scheduled events were never stored, rebuild them for the restored state
+    MapPages();
+    ppu.MapNameTables();
+    bScheduleDirty = true;
+
+    if(pLockstep){
+        pLockstep->LoadState(pBuffer, nSize);
+        bLockstepDiverged = false;
+    }
+
+    return true;
+}
+
+void Bus::SetRunMode(RUNMODE mode){
+    nRunMode = mode;
+    bScheduleDirty = true;
+
+    if(nRunMode == RUN_LOCKSTEP){
+        if(cart)
+            StartLockstep();
+    }
+    else{
+        delete pLockstep;
+        pLockstep = nullptr;
+    }
+}
+
+void Bus::StartLockstep(){
+    //The reference runs the same cartridge image dot by dot
+    delete pLockstep;
+    pLockstep = new Bus();
+    pLockstep->nRunMode = RUN_DOT;
+    pLockstep->ppu.bBatchRender = false;
+    pLockstep->insertCartridge(std::make_shared<Cartridge>(cart->GetFileName()));
+
+    //Carry over state a reset does not clear
+    memcpy(pLockstep->cpuRam, cpuRam, sizeof(cpuRam));
+    pLockstep->apu = apu;
+
+    bLockstepDiverged = false;
+}
+
+bool Bus::clockLockstep(){
+    if(pLockstep == nullptr || bLockstepDiverged)
+        return clockCatchUp();
+
+    pLockstep->controller[0] = controller[0];
+    pLockstep->controller[1] = controller[1];
+
+    //Stop on every audio sample so the output can be compared too
+    uint64_t nSampleTick = nSystemClockCounter + (APU2A03::nClocksPerSample - 1 - nSystemClockCounter % APU2A03::nClocksPerSample);
+    bool bFrameDone = clockCatchUp(nSampleTick);
+    while (pLockstep->nSystemClockCounter < nSystemClockCounter)
+        pLockstep->clock();
+
+    CompareLockstep();
+
+    return bFrameDone;
 }
 
-void Bus::SetSampleFrequency(uint32_t sample_rate){
-    dAudioTimePerSystemSample = 1.0 / (double)sample_rate;
-    dAudioTimePerNESClock = 1.0 / 5369318.0;
-}
\ No newline at end of file
+void Bus::CompareLockstep(){
+    std::string sDiverged;
+
+    if(nSystemClockCounter != pLockstep->nSystemClockCounter)
+        sDiverged = "Clock";
+    else if(cpu.pc != pLockstep->cpu.pc || cpu.a != pLockstep->cpu.a || cpu.x != pLockstep->cpu.x || cpu.y != pLockstep->cpu.y
+        || cpu.stkp != pLockstep->cpu.stkp || cpu.status != pLockstep->cpu.status || cpu.cycles != pLockstep->cpu.cycles)
+        sDiverged = "CPU";
+    else if(memcmp(cpuRam, pLockstep->cpuRam, sizeof(cpuRam)) != 0)
+        sDiverged = "RAM";
+    else if(memcmp(ppu.pOAM, pLockstep->ppu.pOAM, 256) != 0)
+        sDiverged = "OAM";
+    else if(apu.GetLatestSample() != pLockstep->apu.GetLatestSample())
+        sDiverged = "Audio";
+    else if(ppu.frame_complete != pLockstep->ppu.frame_complete)
+        sDiverged = "Frame";
+    else if(ppu.frame_complete){
+        ppu.frame_complete = false;
+        pLockstep->ppu.frame_complete = false;
+
+        if(memcmp(ppu.GetScreen(), pLockstep->ppu.GetScreen(), PPU2C02::nScreenWidth * PPU2C02::nScreenHeight * sizeof(uint32_t)) != 0)
+            sDiverged = "Screen";
+    }
+
+    if(!sDiverged.empty()){
+        bLockstepDiverged = true;
+        std::cout << "Lockstep diverged (" << sDiverged << ") at clock " << nSystemClockCounter << " PC: " << std::hex << cpu.pc << " / " << pLockstep->cpu.pc << std::dec << std::endl;
+    }
+}
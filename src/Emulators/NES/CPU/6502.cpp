@@ -44,19 +44,460 @@ void CPU6502::clock(){
         opcode = read(pc);
         pc++;
 
-        //GetCycles Count
-        cycles = lookup[opcode].cycles;
+        if(bSwitchDecode){
+            cycles = execute();
+        }
+        else{
+            //GetCycles Count
+            cycles = lookup[opcode].cycles;
 
-        uint8_t additional_cycle1 = (this->*lookup[opcode].addrmode)();
+            uint8_t additional_cycle1 = (this->*lookup[opcode].addrmode)();
 
-        uint8_t additional_cycle2 = (this->*lookup[opcode].operate)();
+            uint8_t additional_cycle2 = (this->*lookup[opcode].operate)();
 
-        cycles += (additional_cycle1 & additional_cycle2);
+            cycles += (additional_cycle1 & additional_cycle2);
+        }
+
+        nInstructionCount++;
     }
 
     cycles--;
 }
 
+uint8_t CPU6502::execute(){
+	//Fused decode: addressing mode and operation resolved per opcode at compile time,
+	//returns the total cycle count including page-cross and branch penalties
+	uint8_t page = 0;
+
+	auto Push = [&](uint8_t data)
+	{
+		write(0x0100 + stkp, data);
+		stkp--;
+	};
+
+	auto Pull = [&]() -> uint8_t
+	{
+		stkp++;
+		return read(0x0100 + stkp);
+	};
+
+	auto SetNZ = [&](uint8_t v)
+	{
+		status = (status & ~(Z | N)) | (v == 0x00 ? Z : 0) | (v & N);
+	};
+
+	auto AddrZP0 = [&]() -> uint16_t
+	{
+		return read(pc++);
+	};
+
+	auto AddrZPX = [&]() -> uint16_t
+	{
+		return (read(pc++) + x) & 0x00FF;
+	};
+
+	auto AddrZPY = [&]() -> uint16_t
+	{
+		return (read(pc++) + y) & 0x00FF;
+	};
+
+	auto AddrABS = [&]() -> uint16_t
+	{
+		uint16_t lo = read(pc++);
+		uint16_t hi = read(pc++);
+		return (hi << 8) | lo;
+	};
+
+	auto AddrABX = [&]() -> uint16_t
+	{
+		uint16_t base = AddrABS();
+		uint16_t addr = base + x;
+		page = (addr & 0xFF00) != (base & 0xFF00);
+		return addr;
+	};
+
+	auto AddrABY = [&]() -> uint16_t
+	{
+		uint16_t base = AddrABS();
+		uint16_t addr = base + y;
+		page = (addr & 0xFF00) != (base & 0xFF00);
+		return addr;
+	};
+
+	auto AddrIND = [&]() -> uint16_t
+	{
+		uint16_t ptr = AddrABS();
+		uint16_t lo = read(ptr);
+		//Hardware bug: the high byte never crosses a page boundary
+		uint16_t hi = read((ptr & 0x00FF) == 0x00FF ? (ptr & 0xFF00) : (ptr + 1));
+		return (hi << 8) | lo;
+	};
+
+	auto AddrIZX = [&]() -> uint16_t
+	{
+		uint16_t t = read(pc++);
+		uint16_t lo = read((t + x) & 0x00FF);
+		uint16_t hi = read((t + x + 1) & 0x00FF);
+		return (hi << 8) | lo;
+	};
+
+	auto AddrIZY = [&]() -> uint16_t
+	{
+		uint16_t t = read(pc++);
+		uint16_t lo = read(t & 0x00FF);
+		uint16_t hi = read((t + 1) & 0x00FF);
+		uint16_t addr = ((hi << 8) | lo) + y;
+		page = (addr & 0xFF00) != (hi << 8);
+		return addr;
+	};
+
+	//ADC, and SBC with the operand inverted
+	auto Add = [&](uint8_t v)
+	{
+		uint16_t temp = (uint16_t)a + (uint16_t)v + (uint16_t)(status & C);
+		SetFlag(C, temp > 255);
+		SetFlag(V, (~((uint16_t)a ^ (uint16_t)v) & ((uint16_t)a ^ temp)) & 0x0080);
+		a = temp & 0x00FF;
+		SetNZ(a);
+	};
+
+	auto Compare = [&](uint8_t reg, uint8_t v)
+	{
+		SetFlag(C, reg >= v);
+		SetNZ(reg - v);
+	};
+
+	auto Bit = [&](uint8_t v)
+	{
+		SetFlag(Z, (a & v) == 0x00);
+		SetFlag(N, v & (1 << 7));
+		SetFlag(V, v & (1 << 6));
+	};
+
+	auto ShiftLeft = [&](uint8_t v) -> uint8_t
+	{
+		SetFlag(C, v & 0x80);
+		v <<= 1;
+		SetNZ(v);
+		return v;
+	};
+
+	auto ShiftRight = [&](uint8_t v) -> uint8_t
+	{
+		SetFlag(C, v & 0x01);
+		v >>= 1;
+		SetNZ(v);
+		return v;
+	};
+
+	auto RotateLeft = [&](uint8_t v) -> uint8_t
+	{
+		uint8_t carry = status & C;
+		SetFlag(C, v & 0x80);
+		v = (v << 1) | carry;
+		SetNZ(v);
+		return v;
+	};
+
+	auto RotateRight = [&](uint8_t v) -> uint8_t
+	{
+		uint8_t carry = status & C;
+		SetFlag(C, v & 0x01);
+		v = (v >> 1) | (carry << 7);
+		SetNZ(v);
+		return v;
+	};
+
+	auto Increment = [&](uint8_t v) -> uint8_t
+	{
+		v++;
+		SetNZ(v);
+		return v;
+	};
+
+	auto Decrement = [&](uint8_t v) -> uint8_t
+	{
+		v--;
+		SetNZ(v);
+		return v;
+	};
+
+	//Returns the extra cycles taken by a branch
+	auto Branch = [&](bool taken) -> uint8_t
+	{
+		uint16_t rel = read(pc++);
+		if (rel & 0x80)
+			rel |= 0xFF00;
+		if (!taken)
+			return 0;
+		uint16_t target = pc + rel;
+		uint8_t extra = ((target & 0xFF00) != (pc & 0xFF00)) ? 2 : 1;
+		pc = target;
+		return extra;
+	};
+
+	switch (opcode)
+	{
+	case 0x00: pc += 2; SetFlag(I, true); Push(pc >> 8); Push(pc & 0x00FF); Push(status | B); status &= ~B; pc = (uint16_t)read(0xFFFE) | ((uint16_t)read(0xFFFF) << 8); return 7;
+	case 0x01: a |= read(AddrIZX()); SetNZ(a); return 6;
+	case 0x02: return 2;
+	case 0x03: return 8;
+	case 0x04: return 3;
+	case 0x05: a |= read(AddrZP0()); SetNZ(a); return 3;
+	case 0x06: { uint16_t t = AddrZP0(); write(t, ShiftLeft(read(t))); } return 5;
+	case 0x07: return 5;
+	case 0x08: Push(status | B | U); status &= ~(B | U); return 3;
+	case 0x09: a |= read(pc++); SetNZ(a); return 2;
+	case 0x0A: a = ShiftLeft(a); return 2;
+	case 0x0B: return 2;
+	case 0x0C: return 4;
+	case 0x0D: a |= read(AddrABS()); SetNZ(a); return 4;
+	case 0x0E: { uint16_t t = AddrABS(); write(t, ShiftLeft(read(t))); } return 6;
+	case 0x0F: return 6;
+	case 0x10: return 2 + Branch(!(status & N));
+	case 0x11: a |= read(AddrIZY()); SetNZ(a); return 5 + page;
+	case 0x12: return 2;
+	case 0x13: return 8;
+	case 0x14: return 4;
+	case 0x15: a |= read(AddrZPX()); SetNZ(a); return 4;
+	case 0x16: { uint16_t t = AddrZPX(); write(t, ShiftLeft(read(t))); } return 6;
+	case 0x17: return 6;
+	case 0x18: SetFlag(C, false); return 2;
+	case 0x19: a |= read(AddrABY()); SetNZ(a); return 4 + page;
+	case 0x1A: return 2;
+	case 0x1B: return 7;
+	case 0x1C: return 4;
+	case 0x1D: a |= read(AddrABX()); SetNZ(a); return 4 + page;
+	case 0x1E: { uint16_t t = AddrABX(); write(t, ShiftLeft(read(t))); } return 7;
+	case 0x1F: return 7;
+	case 0x20: { uint16_t t = AddrABS(); pc--; Push(pc >> 8); Push(pc & 0x00FF); pc = t; } return 6;
+	case 0x21: a &= read(AddrIZX()); SetNZ(a); return 6;
+	case 0x22: return 2;
+	case 0x23: return 8;
+	case 0x24: Bit(read(AddrZP0())); return 3;
+	case 0x25: a &= read(AddrZP0()); SetNZ(a); return 3;
+	case 0x26: { uint16_t t = AddrZP0(); write(t, RotateLeft(read(t))); } return 5;
+	case 0x27: return 5;
+	case 0x28: status = Pull() | U; return 4;
+	case 0x29: a &= read(pc++); SetNZ(a); return 2;
+	case 0x2A: a = RotateLeft(a); return 2;
+	case 0x2B: return 2;
+	case 0x2C: Bit(read(AddrABS())); return 4;
+	case 0x2D: a &= read(AddrABS()); SetNZ(a); return 4;
+	case 0x2E: { uint16_t t = AddrABS(); write(t, RotateLeft(read(t))); } return 6;
+	case 0x2F: return 6;
+	case 0x30: return 2 + Branch((status & N));
+	case 0x31: a &= read(AddrIZY()); SetNZ(a); return 5 + page;
+	case 0x32: return 2;
+	case 0x33: return 8;
+	case 0x34: return 4;
+	case 0x35: a &= read(AddrZPX()); SetNZ(a); return 4;
+	case 0x36: { uint16_t t = AddrZPX(); write(t, RotateLeft(read(t))); } return 6;
+	case 0x37: return 6;
+	case 0x38: SetFlag(C, true); return 2;
+	case 0x39: a &= read(AddrABY()); SetNZ(a); return 4 + page;
+	case 0x3A: return 2;
+	case 0x3B: return 7;
+	case 0x3C: return 4;
+	case 0x3D: a &= read(AddrABX()); SetNZ(a); return 4 + page;
+	case 0x3E: { uint16_t t = AddrABX(); write(t, RotateLeft(read(t))); } return 7;
+	case 0x3F: return 7;
+	case 0x40: status = Pull() & ~(B | U); pc = Pull(); pc |= (uint16_t)Pull() << 8; return 6;
+	case 0x41: a ^= read(AddrIZX()); SetNZ(a); return 6;
+	case 0x42: return 2;
+	case 0x43: return 8;
+	case 0x44: return 3;
+	case 0x45: a ^= read(AddrZP0()); SetNZ(a); return 3;
+	case 0x46: { uint16_t t = AddrZP0(); write(t, ShiftRight(read(t))); } return 5;
+	case 0x47: return 5;
+	case 0x48: Push(a); return 3;
+	case 0x49: a ^= read(pc++); SetNZ(a); return 2;
+	case 0x4A: a = ShiftRight(a); return 2;
+	case 0x4B: return 2;
+	case 0x4C: pc = AddrABS(); return 3;
+	case 0x4D: a ^= read(AddrABS()); SetNZ(a); return 4;
+	case 0x4E: { uint16_t t = AddrABS(); write(t, ShiftRight(read(t))); } return 6;
+	case 0x4F: return 6;
+	case 0x50: return 2 + Branch(!(status & V));
+	case 0x51: a ^= read(AddrIZY()); SetNZ(a); return 5 + page;
+	case 0x52: return 2;
+	case 0x53: return 8;
+	case 0x54: return 4;
+	case 0x55: a ^= read(AddrZPX()); SetNZ(a); return 4;
+	case 0x56: { uint16_t t = AddrZPX(); write(t, ShiftRight(read(t))); } return 6;
+	case 0x57: return 6;
+	case 0x58: SetFlag(I, false); return 2;
+	case 0x59: a ^= read(AddrABY()); SetNZ(a); return 4 + page;
+	case 0x5A: return 2;
+	case 0x5B: return 7;
+	case 0x5C: return 4;
+	case 0x5D: a ^= read(AddrABX()); SetNZ(a); return 4 + page;
+	case 0x5E: { uint16_t t = AddrABX(); write(t, ShiftRight(read(t))); } return 7;
+	case 0x5F: return 7;
+	case 0x60: pc = Pull(); pc |= (uint16_t)Pull() << 8; pc++; return 6;
+	case 0x61: Add(read(AddrIZX())); return 6;
+	case 0x62: return 2;
+	case 0x63: return 8;
+	case 0x64: return 3;
+	case 0x65: Add(read(AddrZP0())); return 3;
+	case 0x66: { uint16_t t = AddrZP0(); write(t, RotateRight(read(t))); } return 5;
+	case 0x67: return 5;
+	case 0x68: a = Pull(); SetNZ(a); return 4;
+	case 0x69: Add(read(pc++)); return 2;
+	case 0x6A: a = RotateRight(a); return 2;
+	case 0x6B: return 2;
+	case 0x6C: pc = AddrIND(); return 5;
+	case 0x6D: Add(read(AddrABS())); return 4;
+	case 0x6E: { uint16_t t = AddrABS(); write(t, RotateRight(read(t))); } return 6;
+	case 0x6F: return 6;
+	case 0x70: return 2 + Branch((status & V));
+	case 0x71: Add(read(AddrIZY())); return 5 + page;
+	case 0x72: return 2;
+	case 0x73: return 8;
+	case 0x74: return 4;
+	case 0x75: Add(read(AddrZPX())); return 4;
+	case 0x76: { uint16_t t = AddrZPX(); write(t, RotateRight(read(t))); } return 6;
+	case 0x77: return 6;
+	case 0x78: SetFlag(I, true); return 2;
+	case 0x79: Add(read(AddrABY())); return 4 + page;
+	case 0x7A: return 2;
+	case 0x7B: return 7;
+	case 0x7C: return 4;
+	case 0x7D: Add(read(AddrABX())); return 4 + page;
+	case 0x7E: { uint16_t t = AddrABX(); write(t, RotateRight(read(t))); } return 7;
+	case 0x7F: return 7;
+	case 0x80: return 2;
+	case 0x81: write(AddrIZX(), a); return 6;
+	case 0x82: return 2;
+	case 0x83: return 6;
+	case 0x84: write(AddrZP0(), y); return 3;
+	case 0x85: write(AddrZP0(), a); return 3;
+	case 0x86: write(AddrZP0(), x); return 3;
+	case 0x87: return 3;
+	case 0x88: y--; SetNZ(y); return 2;
+	case 0x89: return 2;
+	case 0x8A: a = x; SetNZ(a); return 2;
+	case 0x8B: return 2;
+	case 0x8C: write(AddrABS(), y); return 4;
+	case 0x8D: write(AddrABS(), a); return 4;
+	case 0x8E: write(AddrABS(), x); return 4;
+	case 0x8F: return 4;
+	case 0x90: return 2 + Branch(!(status & C));
+	case 0x91: write(AddrIZY(), a); return 6;
+	case 0x92: return 2;
+	case 0x93: return 6;
+	case 0x94: write(AddrZPX(), y); return 4;
+	case 0x95: write(AddrZPX(), a); return 4;
+	case 0x96: write(AddrZPY(), x); return 4;
+	case 0x97: return 4;
+	case 0x98: a = y; SetNZ(a); return 2;
+	case 0x99: write(AddrABY(), a); return 5;
+	case 0x9A: stkp = x; return 2;
+	case 0x9B: return 5;
+	case 0x9C: return 5;
+	case 0x9D: write(AddrABX(), a); return 5;
+	case 0x9E: return 5;
+	case 0x9F: return 5;
+	case 0xA0: y = read(pc++); SetNZ(y); return 2;
+	case 0xA1: a = read(AddrIZX()); SetNZ(a); return 6;
+	case 0xA2: x = read(pc++); SetNZ(x); return 2;
+	case 0xA3: return 6;
+	case 0xA4: y = read(AddrZP0()); SetNZ(y); return 3;
+	case 0xA5: a = read(AddrZP0()); SetNZ(a); return 3;
+	case 0xA6: x = read(AddrZP0()); SetNZ(x); return 3;
+	case 0xA7: return 3;
+	case 0xA8: y = a; SetNZ(y); return 2;
+	case 0xA9: a = read(pc++); SetNZ(a); return 2;
+	case 0xAA: x = a; SetNZ(x); return 2;
+	case 0xAB: return 2;
+	case 0xAC: y = read(AddrABS()); SetNZ(y); return 4;
+	case 0xAD: a = read(AddrABS()); SetNZ(a); return 4;
+	case 0xAE: x = read(AddrABS()); SetNZ(x); return 4;
+	case 0xAF: return 4;
+	case 0xB0: return 2 + Branch((status & C));
+	case 0xB1: a = read(AddrIZY()); SetNZ(a); return 5 + page;
+	case 0xB2: return 2;
+	case 0xB3: return 5;
+	case 0xB4: y = read(AddrZPX()); SetNZ(y); return 4;
+	case 0xB5: a = read(AddrZPX()); SetNZ(a); return 4;
+	case 0xB6: x = read(AddrZPY()); SetNZ(x); return 4;
+	case 0xB7: return 4;
+	case 0xB8: SetFlag(V, false); return 2;
+	case 0xB9: a = read(AddrABY()); SetNZ(a); return 4 + page;
+	case 0xBA: x = stkp; SetNZ(x); return 2;
+	case 0xBB: return 4;
+	case 0xBC: y = read(AddrABX()); SetNZ(y); return 4 + page;
+	case 0xBD: a = read(AddrABX()); SetNZ(a); return 4 + page;
+	case 0xBE: x = read(AddrABY()); SetNZ(x); return 4 + page;
+	case 0xBF: return 4;
+	case 0xC0: Compare(y, read(pc++)); return 2;
+	case 0xC1: Compare(a, read(AddrIZX())); return 6;
+	case 0xC2: return 2;
+	case 0xC3: return 8;
+	case 0xC4: Compare(y, read(AddrZP0())); return 3;
+	case 0xC5: Compare(a, read(AddrZP0())); return 3;
+	case 0xC6: { uint16_t t = AddrZP0(); write(t, Decrement(read(t))); } return 5;
+	case 0xC7: return 5;
+	case 0xC8: y++; SetNZ(y); return 2;
+	case 0xC9: Compare(a, read(pc++)); return 2;
+	case 0xCA: x--; SetNZ(x); return 2;
+	case 0xCB: return 2;
+	case 0xCC: Compare(y, read(AddrABS())); return 4;
+	case 0xCD: Compare(a, read(AddrABS())); return 4;
+	case 0xCE: { uint16_t t = AddrABS(); write(t, Decrement(read(t))); } return 6;
+	case 0xCF: return 6;
+	case 0xD0: return 2 + Branch(!(status & Z));
+	case 0xD1: Compare(a, read(AddrIZY())); return 5 + page;
+	case 0xD2: return 2;
+	case 0xD3: return 8;
+	case 0xD4: return 4;
+	case 0xD5: Compare(a, read(AddrZPX())); return 4;
+	case 0xD6: { uint16_t t = AddrZPX(); write(t, Decrement(read(t))); } return 6;
+	case 0xD7: return 6;
+	case 0xD8: SetFlag(D, false); return 2;
+	case 0xD9: Compare(a, read(AddrABY())); return 4 + page;
+	case 0xDA: return 2;
+	case 0xDB: return 7;
+	case 0xDC: return 4;
+	case 0xDD: Compare(a, read(AddrABX())); return 4 + page;
+	case 0xDE: { uint16_t t = AddrABX(); write(t, Decrement(read(t))); } return 7;
+	case 0xDF: return 7;
+	case 0xE0: Compare(x, read(pc++)); return 2;
+	case 0xE1: Add(read(AddrIZX()) ^ 0xFF); return 6;
+	case 0xE2: return 2;
+	case 0xE3: return 8;
+	case 0xE4: Compare(x, read(AddrZP0())); return 3;
+	case 0xE5: Add(read(AddrZP0()) ^ 0xFF); return 3;
+	case 0xE6: { uint16_t t = AddrZP0(); write(t, Increment(read(t))); } return 5;
+	case 0xE7: return 5;
+	case 0xE8: x++; SetNZ(x); return 2;
+	case 0xE9: Add(read(pc++) ^ 0xFF); return 2;
+	case 0xEA: return 2;
+	case 0xEB: Add(a ^ 0xFF); return 2;
+	case 0xEC: Compare(x, read(AddrABS())); return 4;
+	case 0xED: Add(read(AddrABS()) ^ 0xFF); return 4;
+	case 0xEE: { uint16_t t = AddrABS(); write(t, Increment(read(t))); } return 6;
+	case 0xEF: return 6;
+	case 0xF0: return 2 + Branch((status & Z));
+	case 0xF1: Add(read(AddrIZY()) ^ 0xFF); return 5;
+	case 0xF2: return 2;
+	case 0xF3: return 8;
+	case 0xF4: return 4;
+	case 0xF5: Add(read(AddrZPX()) ^ 0xFF); return 4;
+	case 0xF6: { uint16_t t = AddrZPX(); write(t, Increment(read(t))); } return 6;
+	case 0xF7: return 6;
+	case 0xF8: SetFlag(D, true); return 2;
+	case 0xF9: Add(read(AddrABY()) ^ 0xFF); return 4;
+	case 0xFA: return 2;
+	case 0xFB: return 7;
+	case 0xFC: return 4;
+	case 0xFD: Add(read(AddrABX()) ^ 0xFF); return 4;
+	case 0xFE: { uint16_t t = AddrABX(); write(t, Increment(read(t))); } return 7;
+	case 0xFF: return 7;
+	}
+	return 0;
+}
+
 uint8_t CPU6502::GetFlag(FLAGS6502 f)
 {
 	return ((status & f) > 0) ? 1 : 0;
@@ -430,6 +871,21 @@ void CPU6502::reset()
 	cycles = 8;
 }
 
+void CPU6502::Serialize(StateStream& s)
+{
+	s.Field(a);
+	s.Field(x);
+	s.Field(y);
+	s.Field(stkp);
+	s.Field(pc);
+	s.Field(status);
+	s.Field(fetched);
+	s.Field(addr_abs);
+	s.Field(addr_rel);
+	s.Field(opcode);
+	s.Field(cycles);
+}
+
 void CPU6502::irq(){
     if(GetFlag(I) == 0){
         write(0x0100 + stkp, (pc >> 8) & 0x00FF);
@@ -437,11 +893,12 @@ void CPU6502::irq(){
         write(0x0100 + stkp, pc & 0x00FF);
         stkp--;
 
+        //Pushed status keeps the old I flag so RTI re-enables interrupts
         SetFlag(B, 0);
         SetFlag(U, 1);
-        SetFlag(I, 1);
         write(0x0100 + stkp, status);
         stkp--;
+        SetFlag(I, 1);
 
         addr_abs = 0xFFFE;
         uint16_t lo = read(addr_abs + 0);
@@ -461,9 +918,9 @@ void CPU6502::nmi(){
 
     SetFlag(B, 0);
     SetFlag(U, 1);
-    SetFlag(I, 1);
     write(0x0100 + stkp, status);
     stkp--;
+    SetFlag(I, 1);
 
     addr_abs = 0xFFFA;
     uint16_t lo = read(addr_abs + 0);
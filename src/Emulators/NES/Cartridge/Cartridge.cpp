@@ -20,6 +20,7 @@ Cartridge::Cartridge(const std::string& sFileName)
 	} header;
 
 	bImageValid = false;
+	this->sFileName = sFileName;
 
 	std::ifstream ifs;
 	ifs.open(sFileName, std::ifstream::binary);
@@ -37,6 +38,13 @@ Cartridge::Cartridge(const std::string& sFileName)
 		nMapperID = ((header.mapper2 >> 4) << 4) | (header.mapper1 >> 4);
 		hw_mirror = (header.mapper1 & 0x01) ? VERTICAL : HORIZONTAL;
 
+		// Four screen boards carry their own nametable ram and ignore mirroring
+		if (header.mapper1 & 0x08)
+		{
+			hw_mirror = FOURSCREEN;
+			vVRAM.resize(2048);
+		}
+
 		// "Discover" File Format
 		uint8_t nFileType = 1;
 		if ((header.mapper2 & 0x0C) == 0x08) nFileType = 2;
@@ -77,6 +85,14 @@ Cartridge::Cartridge(const std::string& sFileName)
 			ifs.read((char*)vCHRMemory.data(), vCHRMemory.size());
 		}
 
+		// Identifies the image save states were taken from, CHR ram is left out
+		nImageHash = 2166136261u;
+		for (uint8_t b : vPRGMemory)
+			nImageHash = (nImageHash ^ b) * 16777619u;
+		if (nCHRBanks > 0)
+			for (uint8_t b : vCHRMemory)
+				nImageHash = (nImageHash ^ b) * 16777619u;
+
 		// Load appropriate mapper
 		switch (nMapperID)
 		{
@@ -89,6 +105,9 @@ Cartridge::Cartridge(const std::string& sFileName)
 
 		}
 
+		if (pMapper != nullptr)
+			pMapper->MapWindows(vPRGMemory, vCHRMemory);
+
 		bImageValid = true;
 		ifs.close();
 	}
@@ -128,7 +147,16 @@ bool Cartridge::cpuRead(uint16_t addr, uint8_t &data)
 bool Cartridge::cpuWrite(uint16_t addr, uint8_t data)
 {
 	uint32_t mapped_addr = 0;
-	if (pMapper->cpuMapWrite(addr, mapped_addr, data))
+	bool bHandled = pMapper->cpuMapWrite(addr, mapped_addr, data);
+
+	// Only a bank or mirroring register write can move a window
+	if (pMapper->bBanksDirty)
+	{
+		pMapper->bBanksDirty = false;
+		pMapper->MapWindows(vPRGMemory, vCHRMemory);
+	}
+
+	if (bHandled)
 	{
 		if (mapped_addr == 0xFFFFFFFF)
 		{
@@ -146,8 +174,38 @@ bool Cartridge::cpuWrite(uint16_t addr, uint8_t data)
 		return false;
 }
 
+void Cartridge::GetCPUPage(uint16_t addr, const uint8_t* &pRead, uint8_t* &pWrite)
+{
+	pRead = nullptr;
+	pWrite = nullptr;
+
+	if (addr >= 0x8000)
+	{
+		// PRG is read only, writes still go to the mapper registers
+		const uint8_t* pWindow = pMapper->pPRGWindow[(addr >> 13) & 0x03];
+		if (pWindow != nullptr)
+			pRead = pWindow + (addr & 0x1F00);
+		return;
+	}
+
+	uint32_t mapped_addr = 0;
+	uint8_t data = 0;
+	if (pMapper->cpuMapRead(addr, mapped_addr, data) && mapped_addr == 0xFFFFFFFF)
+	{
+		// Cartridge RAM can be read and written in place
+		pWrite = pMapper->GetStaticRAM(addr);
+		pRead = pWrite;
+	}
+}
+
 bool Cartridge::ppuRead(uint16_t addr, uint8_t & data)
 {
+	if (addr < 0x2000 && pMapper->pCHRWindow[addr >> 10] != nullptr)
+	{
+		data = pMapper->pCHRWindow[addr >> 10][addr & 0x03FF];
+		return true;
+	}
+
 	uint32_t mapped_addr = 0;
 	if (pMapper->ppuMapRead(addr, mapped_addr))
 	{
@@ -176,11 +234,17 @@ void Cartridge::reset()
 	// Note: This does not reset the ROM contents,
 	// but does reset the mapper.
 	if (pMapper != nullptr)
+	{
 		pMapper->reset();
+		pMapper->MapWindows(vPRGMemory, vCHRMemory);
+	}
 }
 
 MIRROR Cartridge::Mirror()
 {
+	if (hw_mirror == MIRROR::FOURSCREEN)
+		return hw_mirror;
+
 	MIRROR m = pMapper->mirror();
 	if (m == MIRROR::HARDWARE)
 	{
@@ -200,3 +264,23 @@ std::shared_ptr<Mapper> Cartridge::GetMapper()
 {
 	return pMapper;
 }
+
+uint8_t* Cartridge::GetVRAM()
+{
+	return vVRAM.empty() ? nullptr : vVRAM.data();
+}
+
+void Cartridge::Serialize(StateStream& s)
+{
+	s.Bytes(vVRAM.data(), vVRAM.size());
+
+	// CHR is only ram on boards without CHR banks
+	if (nCHRBanks == 0)
+		s.Bytes(vCHRMemory.data(), vCHRMemory.size());
+
+	pMapper->Serialize(s);
+
+	// Bank windows point into cartridge memory, so they are rebuilt rather than stored
+	if (s.IsLoading())
+		pMapper->MapWindows(vPRGMemory, vCHRMemory);
+}
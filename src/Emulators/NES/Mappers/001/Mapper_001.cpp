@@ -5,7 +5,8 @@ using namespace NES;
 
 Mapper_001::Mapper_001(uint8_t prgBanks, uint8_t chrBanks) : Mapper(prgBanks, chrBanks)
 {
-	vRAMStatic.resize(32 * 1024);
+	// 8KB of PRG RAM at $6000-$7FFF, all a save state needs to hold
+	vRAMStatic.resize(8 * 1024);
 }
 
 
@@ -79,6 +80,7 @@ bool Mapper_001::cpuMapWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 			nLoadRegister = 0x00;
 			nLoadRegisterCount = 0;
 			nControlRegister = nControlRegister | 0x0C;
+			bBanksDirty = true;
 		}
 		else
 		{
@@ -157,6 +159,8 @@ bool Mapper_001::cpuMapWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 					}
 				}
 
+				bBanksDirty = true;
+
 				// 5 bits were written, and decoded, so
 				// reset load register
 				nLoadRegister = 0x00;
@@ -244,4 +248,27 @@ MIRROR Mapper_001::mirror()
 {
 	
 	return mirrormode;
-}
\ No newline at end of file
+}
+
+uint8_t* Mapper_001::GetStaticRAM(uint16_t addr)
+{
+	if (addr >= 0x6000 && addr <= 0x7FFF)
+		return &vRAMStatic[addr & 0x1FFF];
+
+	return nullptr;
+}
+
+void Mapper_001::Serialize(StateStream& s)
+{
+	s.Field(nCHRBankSelect4Lo);
+	s.Field(nCHRBankSelect4Hi);
+	s.Field(nCHRBankSelect8);
+	s.Field(nPRGBankSelect16Lo);
+	s.Field(nPRGBankSelect16Hi);
+	s.Field(nPRGBankSelect32);
+	s.Field(nLoadRegister);
+	s.Field(nLoadRegisterCount);
+	s.Field(nControlRegister);
+	s.Field(mirrormode);
+	s.Bytes(vRAMStatic.data(), vRAMStatic.size());
+}
@@ -34,6 +34,7 @@ bool Mapper_002::cpuMapWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 	if (addr >= 0x8000 && addr <= 0xFFFF)
 	{		
 		nPRGBankSelectLo = data & 0x0F;
+		bBanksDirty = true;
 	}
 
 	// Mapper has handled write, but do not update ROMs
@@ -68,4 +69,10 @@ void Mapper_002::reset()
 {
 	nPRGBankSelectLo = 0;
 	nPRGBankSelectHi = nPRGBanks - 1;
-}
\ No newline at end of file
+}
+
+void Mapper_002::Serialize(StateStream& s)
+{
+	s.Field(nPRGBankSelectLo);
+	s.Field(nPRGBankSelectHi);
+}
@@ -32,6 +32,7 @@ bool Mapper_003::cpuMapWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 	{
 		nCHRBankSelect = data & 0x03;
 		mapped_addr = addr;		
+		bBanksDirty = true;
 	}
 
 	// Mapper has handled write, but do not update ROMs
@@ -57,4 +58,9 @@ bool Mapper_003::ppuMapWrite(uint16_t addr, uint32_t &mapped_addr)
 void Mapper_003::reset()
 {
 	nCHRBankSelect = 0;
-}
\ No newline at end of file
+}
+
+void Mapper_003::Serialize(StateStream& s)
+{
+	s.Field(nCHRBankSelect);
+}
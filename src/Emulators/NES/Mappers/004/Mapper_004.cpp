@@ -5,7 +5,8 @@ using namespace NES;
 
 Mapper_004::Mapper_004(uint8_t prgBanks, uint8_t chrBanks) : Mapper(prgBanks, chrBanks)
 {
-	vRAMStatic.resize(32 * 1024);
+	// 8KB of PRG RAM at $6000-$7FFF, all a save state needs to hold
+	vRAMStatic.resize(8 * 1024);
 }
 
 
@@ -123,6 +124,7 @@ bool Mapper_004::cpuMapWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 
 		}
 
+		bBanksDirty = true;
 		return false;
 	}
 
@@ -135,6 +137,7 @@ bool Mapper_004::cpuMapWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 				mirrormode = MIRROR::HORIZONTAL;
 			else
 				mirrormode = MIRROR::VERTICAL;
+			bBanksDirty = true;
 		}
 		else
 		{
@@ -285,7 +288,53 @@ void Mapper_004::scanline()
 	
 }
 
+int Mapper_004::irqScanlines()
+{
+	if (!bIRQEnable)
+		return -1;
+
+	// Run the counter forward, it reloads at most once before reaching zero
+	uint16_t nCounter = nIRQCounter;
+	for (int n = 1; n <= 257; n++)
+	{
+		if (nCounter == 0)
+			nCounter = nIRQReload;
+		else
+			nCounter--;
+
+		if (nCounter == 0)
+			return n;
+	}
+
+	return -1;
+}
+
 MIRROR Mapper_004::mirror()
 {
 	return mirrormode;
 }
+
+uint8_t* Mapper_004::GetStaticRAM(uint16_t addr)
+{
+	if (addr >= 0x6000 && addr <= 0x7FFF)
+		return &vRAMStatic[addr & 0x1FFF];
+
+	return nullptr;
+}
+
+void Mapper_004::Serialize(StateStream& s)
+{
+	s.Field(nTargetRegister);
+	s.Field(bPRGBankMode);
+	s.Field(bCHRInversion);
+	s.Field(mirrormode);
+	s.Field(pRegister);
+	s.Field(pCHRBank);
+	s.Field(pPRGBank);
+	s.Field(bIRQActive);
+	s.Field(bIRQEnable);
+	s.Field(bIRQUpdate);
+	s.Field(nIRQCounter);
+	s.Field(nIRQReload);
+	s.Bytes(vRAMStatic.data(), vRAMStatic.size());
+}
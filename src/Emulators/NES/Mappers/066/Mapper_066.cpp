@@ -29,6 +29,7 @@ bool Mapper_066::cpuMapWrite(uint16_t addr, uint32_t &mapped_addr, uint8_t data)
 	{
 		nCHRBankSelect = data & 0x03;
 		nPRGBankSelect = (data & 0x30) >> 4;
+		bBanksDirty = true;
 	}
 	
 	// Mapper has handled write, but do not update ROMs
@@ -55,4 +56,10 @@ void Mapper_066::reset()
 {
 	nCHRBankSelect = 0;
 	nPRGBankSelect = 0;
-}
\ No newline at end of file
+}
+
+void Mapper_066::Serialize(StateStream& s)
+{
+	s.Field(nCHRBankSelect);
+	s.Field(nPRGBankSelect);
+}
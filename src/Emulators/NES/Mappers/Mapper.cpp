@@ -28,4 +28,55 @@ void Mapper::irqClear()
 
 void Mapper::scanline()
 {
-}
\ No newline at end of file
+}
+
+int Mapper::irqScanlines()
+{
+	return -1;
+}
+
+uint8_t* Mapper::GetStaticRAM(uint16_t addr)
+{
+	return nullptr;
+}
+
+void Mapper::MapWindows(const std::vector<uint8_t>& vPRG, const std::vector<uint8_t>& vCHR)
+{
+	bool bChanged = false;
+	uint8_t data = 0;
+
+	// Every mapper switches in units of at least 8KB PRG and 1KB CHR,
+	// so the start of each window locates the whole of it
+	for (int i = 0; i < 4; i++)
+	{
+		const uint8_t* pWindow = nullptr;
+		uint32_t mapped_addr = 0;
+		if (cpuMapRead(0x8000 + i * 0x2000, mapped_addr, data) && mapped_addr != 0xFFFFFFFF && mapped_addr + 0x1FFF < vPRG.size())
+			pWindow = &vPRG[mapped_addr];
+
+		bChanged |= pWindow != pPRGWindow[i];
+		pPRGWindow[i] = pWindow;
+	}
+
+	for (int i = 0; i < 8; i++)
+	{
+		const uint8_t* pWindow = nullptr;
+		uint32_t mapped_addr = 0;
+		if (ppuMapRead(i * 0x0400, mapped_addr) && mapped_addr + 0x03FF < vCHR.size())
+			pWindow = &vCHR[mapped_addr];
+
+		bChanged |= pWindow != pCHRWindow[i];
+		pCHRWindow[i] = pWindow;
+	}
+
+	MIRROR m = mirror();
+	bChanged |= m != nWindowMirror;
+	nWindowMirror = m;
+
+	if (bChanged)
+		nGeneration++;
+}
+
+void Mapper::Serialize(StateStream& s)
+{
+}
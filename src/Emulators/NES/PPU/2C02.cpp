@@ -1,78 +1,88 @@
 #include <Emulators/NES/PPU/2C02.h>
+#include <cmath>
+#include <fstream>
 
 using namespace UnifiedEmulation;
 using namespace NES;
 
 PPU2C02::PPU2C02()
-    : sprScreen(ivec2(256, 240)), sprNameTable{PixelImage(ivec2(256, 256)), PixelImage(ivec2(256, 256))}, sprPatternTable{PixelImage(ivec2(128, 128)), PixelImage(ivec2(128, 128))}
+    : vScreen(nScreenWidth * nScreenHeight, PackRGBA(0, 0, 0)), vPatternTable{std::vector<uint32_t>(128 * 128), std::vector<uint32_t>(128 * 128)}
 {
-    palScreen[0x00] = vec3(84, 84, 84);
-	palScreen[0x01] = vec3(0, 30, 116);
-	palScreen[0x02] = vec3(8, 16, 144);
-	palScreen[0x03] = vec3(48, 0, 136);
-	palScreen[0x04] = vec3(68, 0, 100);
-	palScreen[0x05] = vec3(92, 0, 48);
-	palScreen[0x06] = vec3(84, 4, 0);
-	palScreen[0x07] = vec3(60, 24, 0);
-	palScreen[0x08] = vec3(32, 42, 0);
-	palScreen[0x09] = vec3(8, 58, 0);
-	palScreen[0x0A] = vec3(0, 64, 0);
-	palScreen[0x0B] = vec3(0, 60, 0);
-	palScreen[0x0C] = vec3(0, 50, 60);
-	palScreen[0x0D] = vec3(0, 0, 0);
-	palScreen[0x0E] = vec3(0, 0, 0);
-	palScreen[0x0F] = vec3(0, 0, 0);
-
-	palScreen[0x10] = vec3(152, 150, 152);
-	palScreen[0x11] = vec3(8, 76, 196);
-	palScreen[0x12] = vec3(48, 50, 236);
-	palScreen[0x13] = vec3(92, 30, 228);
-	palScreen[0x14] = vec3(136, 20, 176);
-	palScreen[0x15] = vec3(160, 20, 100);
-	palScreen[0x16] = vec3(152, 34, 32);
-	palScreen[0x17] = vec3(120, 60, 0);
-	palScreen[0x18] = vec3(84, 90, 0);
-	palScreen[0x19] = vec3(40, 114, 0);
-	palScreen[0x1A] = vec3(8, 124, 0);
-	palScreen[0x1B] = vec3(0, 118, 40);
-	palScreen[0x1C] = vec3(0, 102, 120);
-	palScreen[0x1D] = vec3(0, 0, 0);
-	palScreen[0x1E] = vec3(0, 0, 0);
-	palScreen[0x1F] = vec3(0, 0, 0);
-
-	palScreen[0x20] = vec3(236, 238, 236);
-	palScreen[0x21] = vec3(76, 154, 236);
-	palScreen[0x22] = vec3(120, 124, 236);
-	palScreen[0x23] = vec3(176, 98, 236);
-	palScreen[0x24] = vec3(228, 84, 236);
-	palScreen[0x25] = vec3(236, 88, 180);
-	palScreen[0x26] = vec3(236, 106, 100);
-	palScreen[0x27] = vec3(212, 136, 32);
-	palScreen[0x28] = vec3(160, 170, 0);
-	palScreen[0x29] = vec3(116, 196, 0);
-	palScreen[0x2A] = vec3(76, 208, 32);
-	palScreen[0x2B] = vec3(56, 204, 108);
-	palScreen[0x2C] = vec3(56, 180, 204);
-	palScreen[0x2D] = vec3(60, 60, 60);
-	palScreen[0x2E] = vec3(0, 0, 0);
-	palScreen[0x2F] = vec3(0, 0, 0);
-
-	palScreen[0x30] = vec3(236, 238, 236);
-	palScreen[0x31] = vec3(168, 204, 236);
-	palScreen[0x32] = vec3(188, 188, 236);
-	palScreen[0x33] = vec3(212, 178, 236);
-	palScreen[0x34] = vec3(236, 174, 236);
-	palScreen[0x35] = vec3(236, 174, 212);
-	palScreen[0x36] = vec3(236, 180, 176);
-	palScreen[0x37] = vec3(228, 196, 144);
-	palScreen[0x38] = vec3(204, 210, 120);
-	palScreen[0x39] = vec3(180, 222, 120);
-	palScreen[0x3A] = vec3(168, 226, 144);
-	palScreen[0x3B] = vec3(152, 226, 180);
-	palScreen[0x3C] = vec3(160, 214, 228);
-	palScreen[0x3D] = vec3(160, 162, 160);
-	palScreen[0x3E] = vec3(0, 0, 0);
-	palScreen[0x3F] = vec3(0, 0, 0);
+    palScreen[0x00] = RGB{84, 84, 84};
+	palScreen[0x01] = RGB{0, 30, 116};
+	palScreen[0x02] = RGB{8, 16, 144};
+	palScreen[0x03] = RGB{48, 0, 136};
+	palScreen[0x04] = RGB{68, 0, 100};
+	palScreen[0x05] = RGB{92, 0, 48};
+	palScreen[0x06] = RGB{84, 4, 0};
+	palScreen[0x07] = RGB{60, 24, 0};
+	palScreen[0x08] = RGB{32, 42, 0};
+	palScreen[0x09] = RGB{8, 58, 0};
+	palScreen[0x0A] = RGB{0, 64, 0};
+	palScreen[0x0B] = RGB{0, 60, 0};
+	palScreen[0x0C] = RGB{0, 50, 60};
+	palScreen[0x0D] = RGB{0, 0, 0};
+	palScreen[0x0E] = RGB{0, 0, 0};
+	palScreen[0x0F] = RGB{0, 0, 0};
+
+	palScreen[0x10] = RGB{152, 150, 152};
+	palScreen[0x11] = RGB{8, 76, 196};
+	palScreen[0x12] = RGB{48, 50, 236};
+	palScreen[0x13] = RGB{92, 30, 228};
+	palScreen[0x14] = RGB{136, 20, 176};
+	palScreen[0x15] = RGB{160, 20, 100};
+	palScreen[0x16] = RGB{152, 34, 32};
+	palScreen[0x17] = RGB{120, 60, 0};
+	palScreen[0x18] = RGB{84, 90, 0};
+	palScreen[0x19] = RGB{40, 114, 0};
+	palScreen[0x1A] = RGB{8, 124, 0};
+	palScreen[0x1B] = RGB{0, 118, 40};
+	palScreen[0x1C] = RGB{0, 102, 120};
+	palScreen[0x1D] = RGB{0, 0, 0};
+	palScreen[0x1E] = RGB{0, 0, 0};
+	palScreen[0x1F] = RGB{0, 0, 0};
+
+	palScreen[0x20] = RGB{236, 238, 236};
+	palScreen[0x21] = RGB{76, 154, 236};
+	palScreen[0x22] = RGB{120, 124, 236};
+	palScreen[0x23] = RGB{176, 98, 236};
+	palScreen[0x24] = RGB{228, 84, 236};
+	palScreen[0x25] = RGB{236, 88, 180};
+	palScreen[0x26] = RGB{236, 106, 100};
+	palScreen[0x27] = RGB{212, 136, 32};
+	palScreen[0x28] = RGB{160, 170, 0};
+	palScreen[0x29] = RGB{116, 196, 0};
+	palScreen[0x2A] = RGB{76, 208, 32};
+	palScreen[0x2B] = RGB{56, 204, 108};
+	palScreen[0x2C] = RGB{56, 180, 204};
+	palScreen[0x2D] = RGB{60, 60, 60};
+	palScreen[0x2E] = RGB{0, 0, 0};
+	palScreen[0x2F] = RGB{0, 0, 0};
+
+	palScreen[0x30] = RGB{236, 238, 236};
+	palScreen[0x31] = RGB{168, 204, 236};
+	palScreen[0x32] = RGB{188, 188, 236};
+	palScreen[0x33] = RGB{212, 178, 236};
+	palScreen[0x34] = RGB{236, 174, 236};
+	palScreen[0x35] = RGB{236, 174, 212};
+	palScreen[0x36] = RGB{236, 180, 176};
+	palScreen[0x37] = RGB{228, 196, 144};
+	palScreen[0x38] = RGB{204, 210, 120};
+	palScreen[0x39] = RGB{180, 222, 120};
+	palScreen[0x3A] = RGB{168, 226, 144};
+	palScreen[0x3B] = RGB{152, 226, 180};
+	palScreen[0x3C] = RGB{160, 214, 228};
+	palScreen[0x3D] = RGB{160, 162, 160};
+	palScreen[0x3E] = RGB{0, 0, 0};
+	palScreen[0x3F] = RGB{0, 0, 0};
+
+	BuildOutputPalette();
+
+	//Power on with clear memory so two systems started together stay identical
+	memset(tblName, 0, sizeof(tblName));
+	memset(tblPalette, 0, sizeof(tblPalette));
+	memset(tblPattern, 0, sizeof(tblPattern));
+	memset(OAM, 0, sizeof(OAM));
 }
 
 PPU2C02::~PPU2C02(){
@@ -83,6 +93,7 @@ PPU2C02::~PPU2C02(){
 uint8_t PPU2C02::cpuRead(uint16_t addr, bool rdonly)
 {
 	uint8_t data = 0x00;
+	Sync();
 
 	if (rdonly)
 	{
@@ -162,6 +173,8 @@ uint8_t PPU2C02::cpuRead(uint16_t addr, bool rdonly)
 
 void PPU2C02::cpuWrite(uint16_t addr, uint8_t data)
 {
+	Sync();
+
 	switch (addr)
 	{
 	case 0x0000: // Control
@@ -224,41 +237,11 @@ uint8_t PPU2C02::ppuRead(uint16_t addr, bool rdonly)
 	}
 	else if (addr >= 0x2000 && addr <= 0x3EFF)
 	{
-		addr &= 0x0FFF;
-
-		if (cart->Mirror() == MIRROR::VERTICAL)
-		{
-			// Vertical
-			if (addr >= 0x0000 && addr <= 0x03FF)
-				data = tblName[0][addr & 0x03FF];
-			if (addr >= 0x0400 && addr <= 0x07FF)
-				data = tblName[1][addr & 0x03FF];
-			if (addr >= 0x0800 && addr <= 0x0BFF)
-				data = tblName[0][addr & 0x03FF];
-			if (addr >= 0x0C00 && addr <= 0x0FFF)
-				data = tblName[1][addr & 0x03FF];
-		}
-		else if (cart->Mirror() == MIRROR::HORIZONTAL)
-		{
-			// Horizontal
-			if (addr >= 0x0000 && addr <= 0x03FF)
-				data = tblName[0][addr & 0x03FF];
-			if (addr >= 0x0400 && addr <= 0x07FF)
-				data = tblName[0][addr & 0x03FF];
-			if (addr >= 0x0800 && addr <= 0x0BFF)
-				data = tblName[1][addr & 0x03FF];
-			if (addr >= 0x0C00 && addr <= 0x0FFF)
-				data = tblName[1][addr & 0x03FF];
-		}
+		data = pNameTable[(addr >> 10) & 0x03][addr & 0x03FF];
 	}
 	else if (addr >= 0x3F00 && addr <= 0x3FFF)
 	{
-		addr &= 0x001F;
-		if (addr == 0x0010) addr = 0x0000;
-		if (addr == 0x0014) addr = 0x0004;
-		if (addr == 0x0018) addr = 0x0008;
-		if (addr == 0x001C) addr = 0x000C;
-		data = tblPalette[addr] & (mask.grayscale ? 0x30 : 0x3F);
+		data = tblPalette[addr & 0x001F] & (mask.grayscale ? 0x30 : 0x3F);
 	}
 
 	return data;
@@ -278,40 +261,15 @@ void PPU2C02::ppuWrite(uint16_t addr, uint8_t data)
 	}
 	else if (addr >= 0x2000 && addr <= 0x3EFF)
 	{
-		addr &= 0x0FFF;
-		if (cart->Mirror() == MIRROR::VERTICAL)
-		{
-			// Vertical
-			if (addr >= 0x0000 && addr <= 0x03FF)
-				tblName[0][addr & 0x03FF] = data;
-			if (addr >= 0x0400 && addr <= 0x07FF)
-				tblName[1][addr & 0x03FF] = data;
-			if (addr >= 0x0800 && addr <= 0x0BFF)
-				tblName[0][addr & 0x03FF] = data;
-			if (addr >= 0x0C00 && addr <= 0x0FFF)
-				tblName[1][addr & 0x03FF] = data;
-		}
-		else if (cart->Mirror() == MIRROR::HORIZONTAL)
-		{
-			// Horizontal
-			if (addr >= 0x0000 && addr <= 0x03FF)
-				tblName[0][addr & 0x03FF] = data;
-			if (addr >= 0x0400 && addr <= 0x07FF)
-				tblName[0][addr & 0x03FF] = data;
-			if (addr >= 0x0800 && addr <= 0x0BFF)
-				tblName[1][addr & 0x03FF] = data;
-			if (addr >= 0x0C00 && addr <= 0x0FFF)
-				tblName[1][addr & 0x03FF] = data;
-		}
+		pNameTable[(addr >> 10) & 0x03][addr & 0x03FF] = data;
 	}
 	else if (addr >= 0x3F00 && addr <= 0x3FFF)
 	{
+		//Backdrop entries are shared between background and sprite palettes
 		addr &= 0x001F;
-		if (addr == 0x0010) addr = 0x0000;
-		if (addr == 0x0014) addr = 0x0004;
-		if (addr == 0x0018) addr = 0x0008;
-		if (addr == 0x001C) addr = 0x000C;
 		tblPalette[addr] = data;
+		if ((addr & 0x0003) == 0)
+			tblPalette[addr ^ 0x0010] = data;
 	}
 }
 
@@ -337,101 +295,422 @@ void PPU2C02::reset()
 	tram_addr.reg = 0x0000;
 	scanline_trigger = false;
 	odd_frame = false;
+	bLineDeferred = false;
+}
+
+void PPU2C02::Serialize(StateStream& s)
+{
+	s.Field(tblName);
+	s.Field(tblPalette);
+	s.Field(OAM);
+	s.Field(oam_addr);
+
+	s.Field(status);
+	s.Field(mask);
+	s.Field(control);
+	s.Field(address_latch);
+	s.Field(ppu_data_buffer);
+	s.Field(vram_addr);
+	s.Field(tram_addr);
+	s.Field(fine_x);
+
+	s.Field(bg_next_tile_id);
+	s.Field(bg_next_tile_attrib);
+	s.Field(bg_next_tile_lsb);
+	s.Field(bg_next_tile_msb);
+	s.Field(bg_shifter_pattern_lo);
+	s.Field(bg_shifter_pattern_hi);
+	s.Field(bg_shifter_attrib_lo);
+	s.Field(bg_shifter_attrib_hi);
+
+	s.Field(spriteScanline);
+	s.Field(sprite_count);
+	s.Field(sprite_shifter_pattern_lo);
+	s.Field(sprite_shifter_pattern_hi);
+	s.Field(bSpriteZeroBeingRendered);
+	s.Field(bSpriteZeroHitPossible);
+
+	s.Field(scanline);
+	s.Field(cycle);
+	s.Field(odd_frame);
+	s.Field(nmi);
+	s.Field(scanline_trigger);
+	s.Field(frame_complete);
+	s.Field(frame_count);
+
+	//Saved states are always synced, a loaded one starts the line on the dot path
+	if(s.IsLoading())
+		bLineDeferred = false;
 }
 
 void PPU2C02::ConnectCartridge(const std::shared_ptr<Cartridge>& cartridge)
 {
 	this->cart = cartridge;
+	pCHRWindow = cartridge->GetMapper()->pCHRWindow;
+	MapNameTables();
+}
+
+void PPU2C02::MapNameTables()
+{
+	uint8_t* pVRAM = cart->GetVRAM();
+
+	switch (cart->Mirror())
+	{
+	case MIRROR::VERTICAL:
+		pNameTable[0] = tblName[0]; pNameTable[1] = tblName[1];
+		pNameTable[2] = tblName[0]; pNameTable[3] = tblName[1];
+		break;
+	case MIRROR::ONESCREEN_LO:
+		pNameTable[0] = tblName[0]; pNameTable[1] = tblName[0];
+		pNameTable[2] = tblName[0]; pNameTable[3] = tblName[0];
+		break;
+	case MIRROR::ONESCREEN_HI:
+		pNameTable[0] = tblName[1]; pNameTable[1] = tblName[1];
+		pNameTable[2] = tblName[1]; pNameTable[3] = tblName[1];
+		break;
+	case MIRROR::FOURSCREEN:
+		pNameTable[0] = tblName[0]; pNameTable[1] = tblName[1];
+		pNameTable[2] = pVRAM; pNameTable[3] = pVRAM + 1024;
+		break;
+	default:
+		pNameTable[0] = tblName[0]; pNameTable[1] = tblName[0];
+		pNameTable[2] = tblName[1]; pNameTable[3] = tblName[1];
+		break;
+	}
 }
 
-PixelImage& PPU2C02::GetScreen(){
-    return this->sprScreen;
+uint32_t PPU2C02::DotsUntilVerticalBlank(){
+	//Dots counted from the pre-render line, vertical blank is raised on scanline 241 cycle 1
+	int32_t nDot = (scanline + 1) * 341 + cycle;
+	int32_t nTarget = 242 * 341 + 1;
+	bool bOdd = odd_frame;
+	bool bSkip = nDot <= 341;
+
+	if(nDot > nTarget){
+		nTarget += 262 * 341;
+		bOdd = !bOdd;
+		bSkip = true;
+	}
+
+	//Odd frames may drop a dot at the start of scanline 0, assume they do
+	return nTarget - nDot - ((bOdd && bSkip) ? 1 : 0);
 }
 
-PixelImage& PPU2C02::GetNameTable(uint8_t i){
-    return this->sprNameTable[i];
+uint32_t PPU2C02::DotsUntilFrameEnd(){
+	//The frame is counted by the last dot of scanline 260
+	int32_t nDot = (scanline + 1) * 341 + cycle;
+	int32_t nTarget = 262 * 341 - 1;
+
+	//Odd frames may drop a dot at the start of scanline 0, assume they do
+	return nTarget - nDot - ((odd_frame && nDot <= 341) ? 1 : 0);
 }
 
-PixelImage& PPU2C02::GetPatternTable(uint8_t i, uint8_t palette){
+uint32_t PPU2C02::DotsUntilScanlineCounter(uint32_t nCount){
+	//The mapper is clocked by the dot that steps to cycle 260 on scanlines -1 to 239
+	int64_t nDot = (scanline + 1) * 341 + cycle;
+	int64_t nLine = (cycle <= 259) ? scanline : scanline + 1;
+	int64_t nFrame = 0;
+
+	while(true){
+		if(nLine >= 261){
+			nLine = -1;
+			nFrame++;
+		}
+		if(nLine < 240 && --nCount == 0)
+			break;
+		nLine++;
+	}
+
+	int64_t nTarget = nFrame * 262 * 341 + (nLine + 1) * 341 + 259;
+
+	//Odd frames may drop a dot at the start of scanline 0, assume every frame does
+	int64_t nSkips = 0;
+	for(int64_t f = 0; f <= nFrame; f++){
+		int64_t nSkipDot = f * 262 * 341 + 341;
+		if(nSkipDot >= nDot && nSkipDot < nTarget)
+			nSkips++;
+	}
+
+	return nTarget - nDot - nSkips;
+}
+
+const uint32_t* PPU2C02::GetPatternTable(uint8_t i, uint8_t palette){
 	for(uint16_t nTileY = 0; nTileY < 16; nTileY++){
 		for(uint16_t nTileX = 0; nTileX < 16; nTileX++){
 			uint16_t nOffset = nTileY * 256 + nTileX * 16;
 
 			for(uint16_t row = 0; row < 8; row++){
-				uint8_t tile_lsb = ppuRead(i * 0x1000 + nOffset + row + 0x0000);
-				uint8_t tile_msb = ppuRead(i * 0x1000 + nOffset + row + 0x0008);
+				uint8_t tile_lsb = PatternRead(i * 0x1000 + nOffset + row + 0x0000);
+				uint8_t tile_msb = PatternRead(i * 0x1000 + nOffset + row + 0x0008);
 
 				for(uint16_t col = 0; col < 8; col++){
 					uint8_t pixel = ((tile_lsb & 0x01) << 1) | (tile_msb & 0x01);
 					tile_lsb >>= 1; tile_msb >>= 1;
 
-					sprPatternTable[i].SetPixel(
-						ivec2(
-							nTileX * 8 + (7 - col),
-							nTileY * 8 + row
-						),
-						GetColorFromPaletteRam(palette, pixel)
-					);
+					vPatternTable[i][(nTileY * 8 + row) * 128 + nTileX * 8 + (7 - col)] = GetColorFromPaletteRam(palette, pixel);
 				}
 			}
 		}
 	}
 
-    return this->sprPatternTable[i];
+    return this->vPatternTable[i].data();
 }
 
-vec3 PPU2C02::GetColorFromPaletteRam(uint8_t palette, uint8_t pixel){
-	return palScreen[ppuRead(0x3F00 + (palette << 2) + pixel) & 0x3F];
+uint32_t PPU2C02::GetColorFromPaletteRam(uint8_t palette, uint8_t pixel){
+	return palOutput[0][tblPalette[(palette << 2) + pixel] & (mask.grayscale ? 0x30 : 0x3F)];
 }
 
-void PPU2C02::clock(){
-	auto IncrementScrollX = [&]()
-	{
-		if (mask.render_background || mask.render_sprites)
-		{
-			if (vram_addr.coarse_x == 31)
-			{
-				vram_addr.coarse_x = 0;
-				vram_addr.nametable_x = ~vram_addr.nametable_x;
-			}
-			else
-			{
-				vram_addr.coarse_x++;
+void PPU2C02::BuildOutputPalette(){
+	for(uint8_t e = 0; e < 8; e++){
+		for(uint8_t i = 0; i < 0x40; i++){
+			float r = palScreen[i].r, g = palScreen[i].g, b = palScreen[i].b;
+
+			//Emphasis darkens the channels that are not emphasised, all three darkens everything,
+			//the blacks in columns $E and $F are left alone
+			if(e != 0 && (i & 0x0E) != 0x0E){
+				if(e == 0x07 || !(e & 0x01)) r *= 0.816328f;
+				if(e == 0x07 || !(e & 0x02)) g *= 0.816328f;
+				if(e == 0x07 || !(e & 0x04)) b *= 0.816328f;
 			}
+
+			palOutput[e][i] = PackRGBA(roundf(r), roundf(g), roundf(b));
 		}
-	};
+	}
+}
+
+bool PPU2C02::LoadPalette(const std::string& sFileName){
+	std::ifstream ifs(sFileName, std::ifstream::binary);
+	if(!ifs.is_open())
+		return false;
+
+	uint8_t data[8 * 0x40 * 3];
+	ifs.read((char*)data, sizeof(data));
+	std::streamsize nSize = ifs.gcount();
+
+	//64 colours without emphasis or all 8 emphasis sets
+	if(nSize != 0x40 * 3 && nSize != sizeof(data))
+		return false;
 
-	auto IncrementScrollY = [&]()
+	Sync();
+	for(uint8_t i = 0; i < 0x40; i++)
+		palScreen[i] = RGB{data[i * 3 + 0], data[i * 3 + 1], data[i * 3 + 2]};
+
+	if(nSize == 0x40 * 3)
+		BuildOutputPalette();
+	else{
+		for(uint16_t i = 0; i < 8 * 0x40; i++)
+			palOutput[i >> 6][i & 0x3F] = PackRGBA(data[i * 3 + 0], data[i * 3 + 1], data[i * 3 + 2]);
+	}
+
+	return true;
+}
+
+void PPU2C02::IncrementScrollX()
+{
+	if (mask.render_background || mask.render_sprites)
 	{
+		if (vram_addr.coarse_x == 31)
+		{
+			vram_addr.coarse_x = 0;
+			vram_addr.nametable_x = ~vram_addr.nametable_x;
+		}
+		else
+		{
+			vram_addr.coarse_x++;
+		}
+	}
+}
 
-		if (mask.render_background || mask.render_sprites)
+void PPU2C02::IncrementScrollY()
+{
+
+	if (mask.render_background || mask.render_sprites)
+	{
+		if (vram_addr.fine_y < 7)
 		{
-			if (vram_addr.fine_y < 7)
+			vram_addr.fine_y++;
+		}
+		else
+		{
+
+			vram_addr.fine_y = 0;
+
+			if (vram_addr.coarse_y == 29)
+			{
+				vram_addr.coarse_y = 0;
+				vram_addr.nametable_y = ~vram_addr.nametable_y;
+			}
+			else if (vram_addr.coarse_y == 31)
 			{
-				vram_addr.fine_y++;
+				vram_addr.coarse_y = 0;
 			}
 			else
 			{
+				vram_addr.coarse_y++;
+			}
+		}
+	}
+}
 
-				vram_addr.fine_y = 0;
+void PPU2C02::clock(){
+	//Visible dots of a line are held back and drawn in one pass at dot 257, unless something looks at the PPU first
+	if(bLineDeferred){
+		if(cycle <= 256){
+			cycle++;
+			return;
+		}
 
-				if (vram_addr.coarse_y == 29)
-				{
-					vram_addr.coarse_y = 0;
-					vram_addr.nametable_y = ~vram_addr.nametable_y;
-				}
-				else if (vram_addr.coarse_y == 31)
-				{
-					vram_addr.coarse_y = 0;
-				}
-				else
-				{
-					vram_addr.coarse_y++;
+		RenderLine();
+		bLineDeferred = false;
+	}
+	else if(bBatchRender && cycle == 1 && scanline >= 0 && scanline < 240
+		&& !(bSpriteZeroHitPossible && mask.render_background && mask.render_sprites)){
+		bLineDeferred = true;
+		cycle++;
+		return;
+	}
+
+	ClockDot();
+}
+
+void PPU2C02::Sync(){
+	if(!bLineDeferred)
+		return;
+
+	//Replay the held back dots through the dot path, the rest of the line stays on it
+	int16_t nTarget = cycle;
+	cycle = 1;
+	bLineDeferred = false;
+	while(cycle < nTarget)
+		ClockDot();
+}
+
+void PPU2C02::RenderLine(){
+	//Produces dots 1 to 256 of the line exactly as ClockDot would, minus sprite zero hits which never batch
+	//Background bytes as they pass through the shifters, the two already loaded then the 31 loaded at dots 9 to 249
+	uint8_t pattern_lo[33], pattern_hi[33], attrib_lo[33], attrib_hi[33];
+	pattern_lo[0] = bg_shifter_pattern_lo >> 8; pattern_lo[1] = bg_shifter_pattern_lo & 0xFF;
+	pattern_hi[0] = bg_shifter_pattern_hi >> 8; pattern_hi[1] = bg_shifter_pattern_hi & 0xFF;
+	attrib_lo[0] = bg_shifter_attrib_lo >> 8; attrib_lo[1] = bg_shifter_attrib_lo & 0xFF;
+	attrib_hi[0] = bg_shifter_attrib_hi >> 8; attrib_hi[1] = bg_shifter_attrib_hi & 0xFF;
+
+	//Each tile is fetched over 8 dots, the first id was already read at the end of the last line
+	for(int nTile = 2; nTile <= 33; nTile++){
+		if(nTile > 2)
+			bg_next_tile_id = NameTableRead(0x2000 | (vram_addr.reg & 0x0FFF));
+
+		bg_next_tile_attrib = NameTableRead(0x23C0 | (vram_addr.nametable_y << 11)
+			                                | (vram_addr.nametable_x << 10)
+			                                | ((vram_addr.coarse_y >> 2) << 3)
+			                                | (vram_addr.coarse_x >> 2));
+		if (vram_addr.coarse_y & 0x02) bg_next_tile_attrib >>= 4;
+		if (vram_addr.coarse_x & 0x02) bg_next_tile_attrib >>= 2;
+		bg_next_tile_attrib &= 0x03;
+
+		bg_next_tile_lsb = PatternRead((control.pattern_background << 12) + ((uint16_t)bg_next_tile_id << 4) + (vram_addr.fine_y) + 0);
+		bg_next_tile_msb = PatternRead((control.pattern_background << 12) + ((uint16_t)bg_next_tile_id << 4) + (vram_addr.fine_y) + 8);
+
+		IncrementScrollX();
+
+		//The last tile is left waiting in the latches for dot 257
+		if(nTile < 33){
+			pattern_lo[nTile] = bg_next_tile_lsb;
+			pattern_hi[nTile] = bg_next_tile_msb;
+			attrib_lo[nTile] = (bg_next_tile_attrib & 0b01) ? 0xFF : 0x00;
+			attrib_hi[nTile] = (bg_next_tile_attrib & 0b10) ? 0xFF : 0x00;
+		}
+	}
+	IncrementScrollY();
+
+	//Every colour the line can use, palette writes always flush the line first
+	uint32_t colours[32];
+	for(uint8_t i = 0; i < 32; i++)
+		colours[i] = GetColorRGBA(i >> 2, i & 0x03);
+
+	//Whole line is written straight into the packed framebuffer
+	uint32_t* pLine = &vScreen[scanline * nScreenWidth];
+
+	for(int x = 0; x < 256; x++){
+		uint8_t bg_pixel = 0x00;
+		uint8_t bg_palette = 0x00;
+
+		if(mask.render_background){
+			int nBit = x + fine_x;
+			uint8_t bit_mux = 0x80 >> (nBit & 0x07);
+
+			bg_pixel = (((pattern_hi[nBit >> 3] & bit_mux) > 0) << 1) | ((pattern_lo[nBit >> 3] & bit_mux) > 0);
+			bg_palette = (((attrib_hi[nBit >> 3] & bit_mux) > 0) << 1) | ((attrib_lo[nBit >> 3] & bit_mux) > 0);
+		}
+
+		uint8_t fg_pixel = 0x00;
+		uint8_t fg_palette = 0x00;
+		uint8_t fg_priority = 0x00;
+
+		if(mask.render_sprites){
+			bSpriteZeroBeingRendered = false;
+
+			//A sprite starts shifting out the dot after its counter reaches zero
+			for(uint8_t i = 0; i < sprite_count; i++){
+				int nCol = x - spriteScanline[i].x;
+				if(nCol < 0 || nCol > 7)
+					continue;
+
+				fg_pixel = (((sprite_shifter_pattern_hi[i] << nCol) & 0x80) > 0) << 1 | (((sprite_shifter_pattern_lo[i] << nCol) & 0x80) > 0);
+				fg_palette = (spriteScanline[i].attribute & 0x03) + 0x04;
+				fg_priority = (spriteScanline[i].attribute & 0x20) == 0;
+
+				if(fg_pixel != 0){
+					if(i == 0)
+						bSpriteZeroBeingRendered = true;
+					break;
 				}
 			}
 		}
-	};
 
+		uint8_t pixel = 0x00;
+		uint8_t palette = 0x00;
+
+		if(fg_pixel > 0 && (bg_pixel == 0 || fg_priority)){
+			pixel = fg_pixel;
+			palette = fg_palette;
+		}
+		else if(bg_pixel > 0){
+			pixel = bg_pixel;
+			palette = bg_palette;
+		}
+
+		pLine[x] = colours[(palette << 2) + pixel];
+	}
+
+	//Leave the shifters where 255 dots of shifting and loading would
+	if(mask.render_background){
+		bg_shifter_pattern_lo = (uint16_t)(pattern_lo[31] << 8 | pattern_lo[32]) << 7;
+		bg_shifter_pattern_hi = (uint16_t)(pattern_hi[31] << 8 | pattern_hi[32]) << 7;
+		bg_shifter_attrib_lo  = (uint16_t)(attrib_lo[31] << 8 | attrib_lo[32]) << 7;
+		bg_shifter_attrib_hi  = (uint16_t)(attrib_hi[31] << 8 | attrib_hi[32]) << 7;
+	}
+	else{
+		bg_shifter_pattern_lo = (bg_shifter_pattern_lo & 0xFF00) | pattern_lo[32];
+		bg_shifter_pattern_hi = (bg_shifter_pattern_hi & 0xFF00) | pattern_hi[32];
+		bg_shifter_attrib_lo  = (bg_shifter_attrib_lo & 0xFF00) | attrib_lo[32];
+		bg_shifter_attrib_hi  = (bg_shifter_attrib_hi & 0xFF00) | attrib_hi[32];
+	}
+
+	if(mask.render_sprites){
+		for(uint8_t i = 0; i < sprite_count; i++){
+			int nShift = 255 - spriteScanline[i].x;
+			spriteScanline[i].x = 0;
+			if(nShift > 0){
+				sprite_shifter_pattern_lo[i] = nShift < 8 ? sprite_shifter_pattern_lo[i] << nShift : 0;
+				sprite_shifter_pattern_hi[i] = nShift < 8 ? sprite_shifter_pattern_hi[i] << nShift : 0;
+			}
+		}
+	}
+
+	cycle = 257;
+}
+
+void PPU2C02::ClockDot(){
 	auto TransferAddressX = [&]()
 	{
 		if (mask.render_background || mask.render_sprites)
@@ -513,11 +792,11 @@ void PPU2C02::clock(){
 			case 0:
 				LoadBackgroundShifters();
 
-				bg_next_tile_id = ppuRead(0x2000 | (vram_addr.reg & 0x0FFF));
+				bg_next_tile_id = NameTableRead(0x2000 | (vram_addr.reg & 0x0FFF));
 
 				break;
 			case 2:				
-				bg_next_tile_attrib = ppuRead(0x23C0 | (vram_addr.nametable_y << 11) 
+				bg_next_tile_attrib = NameTableRead(0x23C0 | (vram_addr.nametable_y << 11) 
 					                                 | (vram_addr.nametable_x << 10) 
 					                                 | ((vram_addr.coarse_y >> 2) << 3) 
 					                                 | (vram_addr.coarse_x >> 2));
@@ -528,13 +807,13 @@ void PPU2C02::clock(){
 				bg_next_tile_attrib &= 0x03;
 				break;
 			case 4: 
-				bg_next_tile_lsb = ppuRead((control.pattern_background << 12) 
+				bg_next_tile_lsb = PatternRead((control.pattern_background << 12) 
 					                       + ((uint16_t)bg_next_tile_id << 4) 
 					                       + (vram_addr.fine_y) + 0);
 
 				break;
 			case 6:
-				bg_next_tile_msb = ppuRead((control.pattern_background << 12)
+				bg_next_tile_msb = PatternRead((control.pattern_background << 12)
 					                       + ((uint16_t)bg_next_tile_id << 4)
 					                       + (vram_addr.fine_y) + 8);
 				break;
@@ -557,7 +836,7 @@ void PPU2C02::clock(){
 		}
 
 		if(cycle == 338 || cycle == 340){
-			bg_next_tile_id = ppuRead(0x2000 | (vram_addr.reg & 0x0FFF));
+			bg_next_tile_id = NameTableRead(0x2000 | (vram_addr.reg & 0x0FFF));
 		}
 
 		if(cycle == 257 && scanline >= 0){
@@ -648,8 +927,8 @@ void PPU2C02::clock(){
 
 				sprite_pattern_addr_hi = sprite_pattern_addr_lo + 8;
 
-				sprite_pattern_bits_lo = ppuRead(sprite_pattern_addr_lo);
-				sprite_pattern_bits_hi = ppuRead(sprite_pattern_addr_hi);
+				sprite_pattern_bits_lo = PatternRead(sprite_pattern_addr_lo);
+				sprite_pattern_bits_hi = PatternRead(sprite_pattern_addr_hi);
 
 				if(spriteScanline[i].attribute & 0x40){
 					auto flipbyte = [](uint8_t b)
@@ -782,8 +1061,9 @@ void PPU2C02::clock(){
 		}
 	}
 
-    //TextureGen
-    sprScreen.SetPixel(ivec2(cycle-1, scanline), GetColorFromPaletteRam(palette, pixel));
+    //TextureGen, dots outside the picture only matter for sprite zero
+    if(scanline >= 0 && scanline < 240 && cycle >= 1 && cycle <= 256)
+        vScreen[scanline * nScreenWidth + cycle - 1] = GetColorRGBA(palette, pixel);
 
     //Advance Renderer
     cycle++;
@@ -791,6 +1071,7 @@ void PPU2C02::clock(){
 		if (cycle == 260 && scanline < 240)
 		{
 			cart->GetMapper()->scanline();
+			scanline_trigger = true;
 		}
 
 	if (cycle >= 341){
@@ -799,6 +1080,7 @@ void PPU2C02::clock(){
 		if (scanline >= 261){
 			scanline = -1;
 			frame_complete = true;
+			frame_count++;
 			odd_frame = !odd_frame;
 		}
 	}
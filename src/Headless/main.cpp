@@ -0,0 +1,119 @@
+#include <Emulators/NES/Farm.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace std;
+using namespace UnifiedEmulation;
+using namespace NES;
+
+//Runs a rom for a number of frames as fast as the core allows, no window, audio device or renderer
+//nes_headless <rom> [--frames=N] [--instances=N] [--threads=N] [--dot | --lockstep] [--wav=out.wav] [--ppm=out.ppm]
+
+//Value after the = of an argument like --frames=600
+static string ArgValue(const string& Arg){
+	size_t nEquals = Arg.find("=");
+	return nEquals != string::npos ? Arg.substr(nEquals + 1) : "";
+}
+
+//Last frame as a binary ppm, alpha dropped
+static bool WritePPM(const string& sFileName, const uint32_t* pScreen){
+	FILE* pFile = fopen(sFileName.c_str(), "wb");
+	if(pFile == nullptr)
+		return false;
+
+	fprintf(pFile, "P6\n%d %d\n255\n", PPU2C02::nScreenWidth, PPU2C02::nScreenHeight);
+	for(int i = 0; i < PPU2C02::nScreenWidth * PPU2C02::nScreenHeight; i++){
+		uint8_t rgb[3] = { (uint8_t)pScreen[i], (uint8_t)(pScreen[i] >> 8), (uint8_t)(pScreen[i] >> 16) };
+		fwrite(rgb, 1, 3, pFile);
+	}
+	fclose(pFile);
+	return true;
+}
+
+int main(int argc, char* argv[]){
+	string RomFile = "";
+	string WavFile = "";
+	string PPMFile = "";
+	int Frames = 600;
+	int Instances = 1;
+	unsigned int Threads = 0;
+	Bus::RUNMODE RunMode = Bus::RUN_CATCHUP;
+
+	for(int i = 1; i < argc; i++){
+		string Arg (argv[i]);
+		if(Arg.find("--frames") == 0)
+			Frames = atoi(ArgValue(Arg).c_str());
+		else if(Arg.find("--instances") == 0)
+			Instances = atoi(ArgValue(Arg).c_str());
+		else if(Arg.find("--threads") == 0)
+			Threads = (unsigned int)atoi(ArgValue(Arg).c_str());
+		else if(Arg.find("--wav") == 0)
+			WavFile = ArgValue(Arg);
+		else if(Arg.find("--ppm") == 0)
+			PPMFile = ArgValue(Arg);
+		else if(Arg == "--lockstep")
+			RunMode = Bus::RUN_LOCKSTEP;
+		else if(Arg == "--dot")
+			RunMode = Bus::RUN_DOT;
+		else
+			RomFile = Arg;
+	}
+
+	if(RomFile.empty() || Frames < 1 || Instances < 1){
+		cout << "Usage: nes_headless <rom> [--frames=N] [--instances=N] [--threads=N] [--dot | --lockstep] [--wav=out.wav] [--ppm=out.ppm]" << endl;
+		return 1;
+	}
+
+	//Every system runs the same rom, only the first one records sound
+	EmulationFarm farm(Threads > 0 ? Threads : min<unsigned int>(Instances, thread::hardware_concurrency()));
+	for(int i = 0; i < Instances; i++){
+		if(farm.AddConsole(RomFile, RunMode) < 0){
+			cout << "Could not load " << RomFile << endl;
+			return 1;
+		}
+	}
+
+	//Audio only goes through the output stage when something is listening, same chain as the frontend
+	if(!WavFile.empty() && !farm.SetAudioSink(0, make_unique<WavSink>(WavFile), 48000)){
+		cout << "Could not open " << WavFile << endl;
+		return 1;
+	}
+
+	auto tStart = chrono::steady_clock::now();
+	farm.RunFrames(Frames);
+	double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+
+	//Hash of the last frame so runs can be compared between builds, run modes and systems
+	auto FrameHash = [](const uint32_t* pScreen){
+		uint32_t nHash = 2166136261u;
+		for(int i = 0; i < PPU2C02::nScreenWidth * PPU2C02::nScreenHeight; i++){
+			nHash = (nHash ^ pScreen[i]) * 16777619u;
+		}
+		return nHash;
+	};
+
+	const uint32_t* pScreen = farm.GetSystem(0).ppu.GetScreen();
+	uint32_t nHash = FrameHash(pScreen);
+	bool bMatch = true;
+	for(int i = 1; i < Instances; i++)
+		bMatch = bMatch && FrameHash(farm.GetSystem(i).ppu.GetScreen()) == nHash;
+
+	if(!PPMFile.empty() && !WritePPM(PPMFile, pScreen))
+		cout << "Could not write " << PPMFile << endl;
+
+	double dFPS = (double)Frames * Instances / dSeconds;
+	printf("%d x %d frames on %u threads in %.3fs, %.1f fps (%.1fx real time), %llu steals, frame hash %08X%s\n",
+		Instances, Frames, farm.GetThreadCount(), dSeconds, dFPS, dFPS / 60.0988, (unsigned long long)farm.GetSteals(), nHash,
+		bMatch ? "" : " (systems differ)");
+
+	bool bDiverged = !bMatch;
+	for(int i = 0; i < Instances && RunMode == Bus::RUN_LOCKSTEP; i++)
+		bDiverged = bDiverged || farm.GetSystem(i).LockstepDiverged();
+	return bDiverged ? 2 : 0;
+}
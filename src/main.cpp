@@ -7,6 +7,12 @@ using namespace UnifiedEngine;
 using namespace UnifiedEmulation;
 using namespace NES;
 
+//Value after the = of an argument like --runahead=2
+static string ArgValue(const string& Arg){
+	size_t nEquals = Arg.find("=");
+	return nEquals != string::npos ? Arg.substr(nEquals + 1) : "";
+}
+
 void UpdateKeys(Game* game) {
 	if (game->Input.Keyboard.KeyPressed(Key_ESCAPE)) {
 		game->quitApplication();
@@ -15,29 +21,55 @@ void UpdateKeys(Game* game) {
 
 int main(int argc, char*argv[]){
     Game game("Game", 780, 480, true, 30, 4, 6, true);
-    NESEmulator emu(&game, "./rsc/Fonts/Font.ttf");
+
+	//Run mode has to be known before the first cartridge is loaded
+	Bus::RUNMODE RunMode = Bus::RUN_CATCHUP;
+	string AudioOut = "";
+	int RunAhead = 0;
+	bool RunAheadThread = false;
+	bool DebugMode = false;
+	//Whole flags only, a rom path or file name may contain any of the words
+	for(int i = 1; i < argc; i++){
+		string Arg (argv[i]);
+		if(Arg.find("--runahead=") == 0)
+			RunAhead = atoi(ArgValue(Arg).c_str());
+		else if(Arg.find("--runahead-thread=") == 0){
+			//Frames ahead run on a second system
+			RunAhead = atoi(ArgValue(Arg).c_str());
+			RunAheadThread = true;
+		}
+		else if(Arg.find("--wav=") == 0)
+			AudioOut = ArgValue(Arg);
+		else if(Arg == "--nullaudio")
+			AudioOut = "null";
+		else if(Arg == "--lockstep")
+			RunMode = Bus::RUN_LOCKSTEP;
+		else if(Arg == "--dot")
+			RunMode = Bus::RUN_DOT;
+		else if(Arg == "--debug")
+			DebugMode = true;
+	}
+
+    NESEmulator emu(&game, "./rsc/Fonts/Font.ttf", RunMode, AudioOut);
+	emu.SetRunAhead(RunAhead, RunAheadThread);
 
 	#if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
 	Console::HideConsole();
 	#endif
 	game.ActiveScene.UI.ScaleWithWindowSize = true;
 
-	*emu.PlayAudio = true;
+	emu.PlayAudio = true;
 	emu.RomHotSwap = true;
 
-	if(argc > 1){
-		string Arg (argv[1]);
-		size_t found = Arg.find("debug");
-		if(found != std::string::npos){
-			emu.DebugMode = true;
+	if(DebugMode){
+		emu.DebugMode = true;
 
-			emu.Debug.Section1 = Debug_Status;
-			emu.Debug.Section2 = Debug_Audio;
-			emu.Debug.Section3 = Debug_Paletts;
-		}
-		else{
-			emu.DebugMode = false;
-		}
+		emu.Debug.Section1 = Debug_Status;
+		emu.Debug.Section2 = Debug_Audio;
+		emu.Debug.Section3 = Debug_Paletts;
+	}
+	else{
+		emu.DebugMode = false;
 	}
 
 	while (!game.getApplicationShouldClose()) {